@@ -149,6 +149,32 @@ Object arraylist_removeIndex(const Arraylist list, const int index){
 
   return toRemove;
 }
+/* removes count objects starting at index with a single memmove. returns number removed */
+int arraylist_removeRange(const Arraylist list, const int index, const int count){
+  int length = arraylist_size(list);
+  int n = count;
+
+  if (index < 0 || index >= length || count <= 0)
+    return 0;
+  if (index + n > length)
+    n = length - index;
+
+  memmove(list->_data + index, list->_data + index + n, object_size * (length - index - n));
+  list->_size -= n;
+  return n;
+}
+/* removes object at index in O(1) by moving the last object into its place (order is not kept).
+   returns the removed object, NULL if index is out of range */
+Object arraylist_swapRemoveIndex(const Arraylist list, const int index){
+  Object toRemove;
+
+  if (index < 0 || index >= list->_size)
+    return NULL;
+  toRemove = list->_data[index];
+  list->_data[index] = list->_data[list->_size - 1];
+  (list->_size)--;
+  return toRemove;
+}
 Boolean arraylist_contains(const Arraylist list, const Object object)
 {
     return (arraylist_index_of(list, object) > -1);
@@ -56,6 +56,8 @@ Arraylist arraylist_create();//const Boolean (*equals)(const Object object_1, co
 int arraylist_add(const Arraylist list, Object object);
 Object arraylist_remove(const Arraylist list, const Object object);
 Object arraylist_removeIndex(const Arraylist list, const int index);
+int arraylist_removeRange(const Arraylist list, const int index, const int count);
+Object arraylist_swapRemoveIndex(const Arraylist list, const int index);
 Boolean arraylist_contains(const Arraylist list, const Object object);
 int arraylist_index_of(const Arraylist list, const Object object);
 Boolean arraylist_is_empty(const Arraylist list);
@@ -0,0 +1,96 @@
+#!/usr/bin/perl
+# Reads irc_proto.c on stdin and prints cmd-hash.h: a minimal perfect hash
+# (hash and displace) over the commands of the cmds[] dispatch table.
+# Keys are case-insensitive. Must hash exactly like cmd_lookup() and
+# cmd_hash_mix() in irc_proto.c.
+use strict;
+use integer;
+
+my $MAX_COMMAND = 16;
+my (@cmds, $intable);
+while (<STDIN>) {
+	$intable = 1 if /^struct dispatch cmds\[\]/;
+	next unless $intable;
+	last if /^};/;
+	if (/^\s*\{\s*"([^"]+)",\s*(\d+),\s*(\d+),\s*(\w+)\s*\}/) {
+		die "command $1 too long\n" if length($1) >= $MAX_COMMAND;
+		push @cmds, { name => uc($1), needreg => $2, minparams => $3, handler => $4 };
+	}
+}
+die "no commands found in cmds[]\n" unless @cmds;
+
+# a * b mod 2^32 without overflowing 64-bit signed integers
+sub mul32 {
+	my ($a, $b) = @_;
+	return (($a * ($b & 0xffff)) + ((($a * ($b >> 16)) & 0xffff) << 16)) & 0xffffffff;
+}
+
+# 32-bit FNV-1a over the upper-cased key, seeded, with a final avalanche
+# so that the low bits used by % are well mixed
+sub fnv {
+	my ($key, $seed) = @_;
+	my $h = (2166136261 ^ $seed) & 0xffffffff;
+	foreach my $c (unpack("C*", $key)) {
+		$h ^= $c;
+		$h = mul32($h, 16777619);
+	}
+	$h ^= $h >> 16;
+	$h = mul32($h, 0x85ebca6b);
+	$h ^= $h >> 13;
+	$h = mul32($h, 0xc2b2ae35);
+	$h ^= $h >> 16;
+	return $h;
+}
+
+my $n = scalar @cmds;
+my $nbuckets = $n;
+my @buckets;
+foreach my $i (0 .. $n - 1) {
+	push @{ $buckets[fnv($cmds[$i]{name}, 0) % $nbuckets] }, $i;
+}
+
+# place biggest buckets first, find a displacement seed putting all their keys in free slots
+my @disp = (0) x $nbuckets;
+my @slot = (-1) x $n;
+foreach my $b (sort { scalar(@{ $buckets[$b] || [] }) <=> scalar(@{ $buckets[$a] || [] }) } 0 .. $nbuckets - 1) {
+	my @keys = @{ $buckets[$b] || [] };
+	next unless @keys;
+	for (my $d = 1; ; $d++) {
+		die "no displacement found\n" if $d > 10000000;
+		my %taken;
+		my $ok = 1;
+		foreach my $k (@keys) {
+			my $s = fnv($cmds[$k]{name}, $d) % $n;
+			if ($slot[$s] >= 0 || exists $taken{$s}) { $ok = 0; last; }
+			$taken{$s} = $k;
+		}
+		next unless $ok;
+		$slot[$_] = $taken{$_} foreach keys %taken;
+		$disp[$b] = $d;
+		last;
+	}
+}
+
+# key packed little-endian into two 64-bit words, as cmd_lookup() does
+sub packed {
+	my ($name) = @_;
+	my @c = unpack("C*", $name);
+	my @w = (0, 0);
+	foreach my $i (0 .. $#c) {
+		$w[$i / 8] |= $c[$i] << (8 * ($i % 8));
+	}
+	return map { sprintf("0x%016xULL", $_) } @w;
+}
+
+print "/* Generated by cmdhash.pl from cmds[] in irc_proto.c. Do not edit. */\n\n";
+print "#define CMD_HASH_NKEYS $n\n";
+print "#define CMD_HASH_NBUCKETS $nbuckets\n\n";
+print "static const unsigned cmd_hash_disp[CMD_HASH_NBUCKETS] = { ", join(", ", @disp), " };\n\n";
+print "static const struct cmd_hash_entry cmd_hash_table[CMD_HASH_NKEYS] = {\n";
+print "    /* key,                                          reg  #parm  function */\n";
+foreach my $s (0 .. $n - 1) {
+	my $c = $cmds[$slot[$s]];
+	my ($k0, $k1) = packed($c->{name});
+	printf "    { { %s, %s }, %d, %d, %s }, /* %s */\n", $k0, $k1, $c->{needreg}, $c->{minparams}, $c->{handler}, $c->{name};
+}
+print "};\n";
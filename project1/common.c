@@ -3,9 +3,32 @@
 #include <string.h>
 #include <unistd.h>
 #include <sys/socket.h>
+#include <errno.h>
+#include <ctype.h>
 #include <netdb.h>
 #include "common.h"
 #include "debug.h"
+#include "hashtab.h"
+#include "intern.h"
+#include "pool.h"
+#include "resolver.h"
+#include "fmt.h"
+#include "message.h"
+#include "cursor.h"
+#include "replygen.h"
+#include "worker.h"
+
+
+static pool_t clientPool = POOL_INITIALIZER("client", sizeof(client_t));
+static pool_t infoPool = POOL_INITIALIZER("client_info", sizeof(client_info_t));
+static pool_t channelPool = POOL_INITIALIZER("channel", sizeof(channel_t));
+static pool_t memberPool = POOL_INITIALIZER("membership", sizeof(membership_t));
+
+/* channel ids. kept dense, so the workers can index their slices by them */
+VEC_DEFINE(idvec, unsigned, 16)
+static idvec_t freeChannelIds; /* set up by initChannelIds() */
+static unsigned nextChannelId = 0;
+static unsigned long channelGeneration = 0;
 
 void freeTokens(char ***ptrToTokenArr, int numTokens){
   int i;
@@ -54,7 +77,7 @@ char **splitByDelimStr(const char *buf, const char *delimStr, int *numTokenPtr,
   nextToken = buf;
   do{
       if (nextToken[0] == '\0' ){
-        lastTokenTerminated = ( nextToken != 0);
+        lastTokenTerminated = (numToken != 0);
         break;
       }
       numToken++;
@@ -64,8 +87,9 @@ char **splitByDelimStr(const char *buf, const char *delimStr, int *numTokenPtr,
         break;
       }
       nextToken = tmp;
-      while (strchr(delimStr, *(nextToken++)))
-          ;
+      /* skip the whole run of delimiters, but never past the terminating NUL */
+      while (*nextToken && strchr(delimStr, *nextToken))
+          nextToken++;
   } while (1);
   if (numToken == 0){
     return NULL;
@@ -78,9 +102,9 @@ char **splitByDelimStr(const char *buf, const char *delimStr, int *numTokenPtr,
     return NULL;
   }
 
-  for (i=0,nextToken=buf; i < numToken-1; i++){
-    char *tokenEnd = strpbrk(nextToken,delimStr); /* guarantee to succeed */
-    tokenSize = tokenEnd - nextToken;
+  for (i=0,nextToken=buf; i < numToken; i++){
+    const char *tokenEnd = strpbrk(nextToken,delimStr); /* NULL only for an unterminated last token */
+    tokenSize = (tokenEnd) ? (size_t)(tokenEnd - nextToken) : strlen(nextToken);
     retArr[i] = malloc (sizeof(char) * (tokenSize + 1) );
     if (!retArr[i]){
         DPRINTF(DEBUG_ERRS,"splitByDelimStr: retArr[%d] malloc failed\n",i);
@@ -89,16 +113,10 @@ char **splitByDelimStr(const char *buf, const char *delimStr, int *numTokenPtr,
     }
     memcpy(retArr[i],nextToken,tokenSize);
     retArr[i][tokenSize] = '\0';
-    nextToken = tokenEnd+1;
-    while (strchr(delimStr, *(nextToken++)))
-        ;
+    nextToken += tokenSize;
+    while (*nextToken && strchr(delimStr, *nextToken))
+        nextToken++;
   }
-  /* handle last token */
-  tokenSize =  (lastTokenTerminated) ? strlen(nextToken) : strpbrk(nextToken,delimStr) - nextToken;
-
-  retArr[numToken-1] = malloc(sizeof(char) * tokenSize);
-  memcpy(retArr[numToken-1],nextToken,tokenSize);
-  retArr[numToken-1][tokenSize] = '\0';
 
   if (numTokenPtr)
       *numTokenPtr = numToken;
@@ -108,134 +126,410 @@ char **splitByDelimStr(const char *buf, const char *delimStr, int *numTokenPtr,
 }
 
 
-int findClientIndexBySockFD(Arraylist list, int sockfd){
-  int i;
-  for (i = 0; i < arraylist_size(list); i++){
-    client_t *tempClient = (client_t *)arraylist_get(list,i);
-    if (tempClient->sock == sockfd)
-    return i;
+client_t **clientTable = NULL;
+int clientTableSize = 0;
+
+int initClientTable(int size){
+  clientTable = calloc(size, sizeof(client_t *));
+  if (!clientTable){
+    DPRINTF(DEBUG_ERRS,"initClientTable: failed to allocate table for %d descriptors\n",size);
+    return -1;
   }
-  return -1;
+  clientTableSize = size;
+  return 0;
 }
-int findClientIndexByNick(Arraylist clientList, char *nick){
-    int i;
-    for (i = 0; i < arraylist_size(clientList); i++){
-        if (strcmp(CLIENT_GET(clientList,i)->nick,nick) == 0){
-            return i;
-        }
+
+void initChannelIds(void){
+  idvec_init(&freeChannelIds);
+}
+
+/* registered nicknames, RFC 1459 case-folded */
+static hashtab_t *nickTable = NULL;
+
+static const char *client_nick_key(const void *client){
+    return ((const client_t *)client)->nick;
+}
+
+client_t *findClientByNick(char *nick){
+    if (!nickTable)
+        return NULL;
+    return hashtab_find(nickTable, nick);
+}
+
+int setClientNick(client_t *client, char *nick){
+    if (!nickTable && !(nickTable = hashtab_create(client_nick_key)))
+        return -1;
+    if (client->nick[0] != '\0')
+        hashtab_remove(nickTable, client);
+    strncpy(client->nick, nick, MAX_USERNAME);
+    client->nick[MAX_USERNAME] = '\0';
+    invalidateClientPrefix(client);
+    if (hashtab_insert(nickTable, client) < 0){
+        DPRINTF(DEBUG_ERRS,"setClientNick: failed to index nick %s\n",client->nick);
+        INIT_STRING(client->nick);
+        return -1;
     }
-    return -1;
+    return 0;
 }
-int findChannelIndexByChanname(Arraylist channelList, char *channame){
-    int i;
-    for (i = 0; i < arraylist_size(channelList); i++){
-        if (strcmp(CHANNEL_GET(channelList,i)->name,channame) == 0){
-            return i;
-        }
+
+/* channel names, RFC 1459 case-folded */
+static hashtab_t *channelTable = NULL;
+
+static const char *channel_name_key(const void *channel){
+    return ((const channel_t *)channel)->name;
+}
+
+channel_t *findChannelByName(char *channame){
+    if (!channelTable)
+        return NULL;
+    return hashtab_find(channelTable, channame);
+}
+
+int addChannelToList(chanvec_t *chanList, channel_t *channel){
+    int index;
+
+    if (!channelTable && !(channelTable = hashtab_create(channel_name_key)))
+        return -1;
+    if (hashtab_insert(channelTable, channel) < 0)
+        return -1;
+    index = chanvec_push(chanList, channel);
+    if (index < 0){
+        hashtab_remove(channelTable, channel);
+        return -1;
     }
-    return -1;
+    channel->listIndex = index;
+    return index;
+}
+
+void remove_channel(chanvec_t *chanList, channel_t *channel){
+    hashtab_remove(channelTable, channel);
+    cursor_removing(&chanList->size, channel->listIndex);
+    chanvec_swap_remove(chanList, channel->listIndex);
+    if (channel->listIndex < chanvec_size(chanList))
+        CHANNEL_GET(chanList,channel->listIndex)->listIndex = channel->listIndex;
+    channel_free(channel);
+}
+
+unsigned long membershipChanges = 0;
+
+membership_t *addMember(channel_t *channel, client_t *client){
+    membership_t *m;
+    member_t member;
+
+    if (membervec_reserve(&channel->members, 1) < 0){
+        DPRINTF(DEBUG_ERRS,"addMember: failed to grow member array of %s\n",channel->name);
+        return NULL;
+    }
+    m = pool_alloc(&memberPool);
+    if (!m){
+        DPRINTF(DEBUG_ERRS,"addMember: failed to allocate membership\n");
+        return NULL;
+    }
+    if (worker_post_join(channel, client) < 0){
+        pool_free(&memberPool, m);
+        return NULL;
+    }
+    m->client = client;
+    m->channel = channel;
+    member.client = client;
+    member.node = m;
+    m->memberIndex = membervec_push(&channel->members, member); /* cannot fail after reserve */
+
+    m->prev = NULL;
+    m->next = client->channels;
+    if (client->channels)
+        client->channels->prev = m;
+    client->channels = m;
+    client->numChannels++;
+    membershipChanges++;
+    return m;
+}
+
+void removeMember(membership_t *m){
+    channel_t *channel = m->channel;
+    client_t *client = m->client;
 
+    worker_post_part(channel, client);
+    /* the last member fills the hole */
+    cursor_removing(&channel->members.size, m->memberIndex);
+    membervec_swap_remove(&channel->members, m->memberIndex);
+    if (m->memberIndex < channel->members.size)
+        channel->members.data[m->memberIndex].node->memberIndex = m->memberIndex;
+
+    if (m->prev)
+        m->prev->next = m->next;
+    else
+        client->channels = m->next;
+    if (m->next)
+        m->next->prev = m->prev;
+    client->numChannels--;
+    membershipChanges++;
+    pool_free(&memberPool, m);
+}
+
+membership_t *findMember(channel_t *channel, client_t *client){
+    membership_t *m;
+
+    for (m = client->channels; m; m = m->next){
+        if (m->channel == channel)
+            return m;
+    }
+    return NULL;
+}
+
+unsigned visitEpoch = 0;
+
+unsigned beginVisit(void){
+    int fd;
+
+    if (++visitEpoch == 0){
+        /* wrapped: old stamps could pass for new ones */
+        for (fd = 0; fd < clientTableSize; fd++){
+            if (clientTable[fd])
+                clientTable[fd]->visitEpoch = 0;
+        }
+        visitEpoch = 1;
+    }
+    return visitEpoch;
 }
 
-int addClientToList(Arraylist list, char *servername, int sockfd, struct sockaddr_storage *remoteaddr){
-    client_t *newClient = client_alloc_init(servername,sockfd,remoteaddr);
+int addClientToList(clientvec_t *list, char *servername, int worker, int sockfd, unsigned long serial, struct sockaddr_storage *remoteaddr){
+    client_t *newClient;
+    int index;
+
+    if (sockfd >= clientTableSize){
+        DPRINTF(DEBUG_SOCKETS,"addClientToList: socket %d is beyond the client table\n",sockfd);
+        worker_post_close(worker, sockfd);
+        return -1;
+    }
+    newClient = client_alloc_init(servername,worker,sockfd,serial,remoteaddr);
     if (!newClient)
         return -1;
-    int index = arraylist_add(list,newClient);
+    index = clientvec_push(list,newClient);
   if (index < 0){
     /* "Sorry we cannot accept your request now. Please try again later" situation */
     /* just close the connection myself. HAHA */
     DPRINTF(DEBUG_SOCKETS,"addClientToList: failed to add client %d to the client list\n",sockfd);
-    arraylist_free(newClient->outbuf);
-    free(newClient);
-    close(sockfd);
+    client_free(newClient);
+    worker_post_close(worker, sockfd);
+    return index;
   }
+  newClient->info->listIndex = index;
+  clientTable[sockfd] = newClient;
+  resolveClientHost(newClient);
 
   return index;
 }
 
-void freeOutbuf(client_t *client){
-  Arraylist outbuf = client->outbuf;
-  int i;
-  for (i = 0; i < arraylist_size(outbuf); i++){
-    free(arraylist_get(outbuf,i));
-  }
-  arraylist_free(outbuf);
-}
-
-client_t *client_alloc_init(char *servername, int sockfd, struct sockaddr_storage *remoteaddr){
+client_t *client_alloc_init(char *servername, int worker, int sockfd, unsigned long serial, struct sockaddr_storage *remoteaddr){
   client_t *newClient;
+  client_info_t *info;
+  char hostname[MAX_HOSTNAME+1];
   int index;
-  newClient = malloc(sizeof(client_t));
-  if (!newClient){
+  newClient = pool_alloc(&clientPool);
+  info = pool_alloc(&infoPool);
+  if (!newClient || !info){
     DPRINTF(DEBUG_ERRS,"client_alloc_init: failed to create client entry for socket %d\n",sockfd);
-    close(sockfd);
+    pool_free(&clientPool, newClient);
+    pool_free(&infoPool, info);
+    worker_post_close(worker, sockfd);
     return NULL;
   }
   /* initialize client entry */
   newClient->sock = sockfd;
-  memcpy(&newClient->cliaddr, remoteaddr, sizeof(struct sockaddr_storage));
-  newClient->inbuf_size = 0;
+  newClient->worker = worker;
+  info->listIndex = -1;
   newClient->registered = FALSE;
-  newClient->outbuf = arraylist_create();
-  newClient->outbuf_offset = 0;
-  INIT_STRING(newClient->hostname);
-  strcpy(newClient->servername,servername);
+  newClient->replying = FALSE;
+  newClient->numChannels = 0;
+  newClient->visitEpoch = 0;
   INIT_STRING(newClient->nick);
-  INIT_STRING(newClient->user);
-  INIT_STRING(newClient->realname);
-  INIT_STRING(newClient->inbuf);
-  newClient->chanlist = arraylist_create();
-  if (  (index = getnameinfo((struct sockaddr *)&newClient->cliaddr,sizeof(struct sockaddr_storage),newClient->hostname,MAX_HOSTNAME,NULL,0,0)) < 0){
-    DPRINTF(DEBUG_SOCKETS,"getnameinfo: %s and hostname: %s\n",gai_strerror(index),newClient->hostname);
-    /* drop the client?? */
-    /*
-        arraylist_free(newClient->outbuf);
-        arraylist_free(newClient->chanlist);
-        free(newClient);
-        return NULL;
-    */
+  newClient->channels = NULL;
+  newClient->info = info;
+
+  memcpy(&info->cliaddr, remoteaddr, sizeof(struct sockaddr_storage));
+  info->realname = NULL;
+  info->prefix = NULL;
+  info->replies = NULL;
+  info->hopcount = 0;
+  INIT_STRING(info->user);
+  info->serial = serial;
+  INIT_STRING(hostname);
+  /* numeric only: never blocks. the name, if any, comes from the resolver later */
+  if (  (index = getnameinfo((struct sockaddr *)&info->cliaddr,sizeof(struct sockaddr_storage),hostname,MAX_HOSTNAME,NULL,0,NI_NUMERICHOST)) != 0){
+    DPRINTF(DEBUG_SOCKETS,"getnameinfo: %s and hostname: %s\n",gai_strerror(index),hostname);
+    strcpy(hostname, "unknown");
+  }
+  /* shared with every other client on the same host / server */
+  info->hostname = intern_acquire(hostname);
+  info->servername = intern_acquire(servername);
+  if (!info->hostname || !info->servername){
+    client_free(newClient);
+    worker_post_close(worker, sockfd);
+    return NULL;
   }
-  newClient->hopcount = 0;
   return newClient;
 
 }
 
+void resolveClientHost(client_t *client){
+  const char *hostname;
+
+  switch (resolver_request(&client->info->cliaddr, client->info->hostname,
+                           client->sock, client->info->serial, &hostname)){
+  case RESOLVE_CACHED:
+    setResolvedHost(client->sock, client->info->serial, hostname);
+    break;
+  case RESOLVE_FAILED:
+    DPRINTF(DEBUG_DNS,"resolveClientHost: %s stays numeric\n",client->info->hostname);
+    break;
+  default:
+    break;
+  }
+}
+
+/* only letters, digits, '-' and '.' may go out in a prefix */
+static int isValidHostname(const char *hostname){
+  const char *p;
+
+  if (!*hostname || strlen(hostname) > MAX_HOSTNAME)
+    return FALSE;
+  for (p = hostname; *p; p++){
+    if (!isalnum((unsigned char)*p) && *p != '-' && *p != '.')
+      return FALSE;
+  }
+  return TRUE;
+}
+
+void setResolvedHost(int fd, unsigned long serial, const char *hostname){
+  client_t *client = findClientBySockFD(fd);
+  const char *name;
+
+  /* gone, or the socket already belongs to somebody else */
+  if (!client || client->info->serial != serial || !hostname)
+    return;
+  if (!isValidHostname(hostname)){
+    DPRINTF(DEBUG_DNS,"setResolvedHost: ignoring bad name for %s\n",client->info->hostname);
+    return;
+  }
+  if (!(name = intern_acquire(hostname)))
+    return;
+  DPRINTF(DEBUG_DNS,"setResolvedHost: %s is %s\n",client->info->hostname,name);
+  intern_release(client->info->hostname);
+  client->info->hostname = name;
+  invalidateClientPrefix(client);
+}
+
+const prefix_t *clientPrefix(client_t *client){
+  static union {
+    prefix_t prefix;
+    char space[sizeof(prefix_t) + MAX_CONTENT_LENGTH + 1];
+  } fallback;
+  client_info_t *info = client->info;
+  unsigned nickLen, len;
+  prefix_t *prefix;
+  fmt_t f;
+
+  if (info->prefix)
+    return info->prefix;
+  nickLen = 1 + strlen(client->nick);
+  len = nickLen + 1 + strlen(info->user) + 1 + strlen(info->hostname);
+  if (len > MAX_CONTENT_LENGTH)
+    len = MAX_CONTENT_LENGTH;
+  prefix = malloc(sizeof(prefix_t) + len + 1);
+  if (!prefix){
+    /* uncached, good until the next call */
+    DPRINTF(DEBUG_ERRS,"clientPrefix: failed to cache prefix of %s\n",client->nick);
+    prefix = &fallback.prefix;
+  }
+  else{
+    info->prefix = prefix;
+  }
+  fmt_init(&f, prefix->text, len + 1);
+  fmt_char(&f, ':');
+  fmt_str(&f, client->nick);
+  fmt_char(&f, '!');
+  fmt_str(&f, info->user);
+  fmt_char(&f, '@');
+  fmt_str(&f, info->hostname);
+  fmt_end(&f);
+  prefix->len = f.len;
+  prefix->nickLen = nickLen < f.len ? nickLen : f.len;
+  return prefix;
+}
+
+void invalidateClientPrefix(client_t *client){
+  free(client->info->prefix);
+  client->info->prefix = NULL;
+}
+
+void client_free(client_t *client){
+  client_info_t *info = client->info;
+
+  replygen_free_all(client);
+  intern_release(info->hostname);
+  intern_release(info->servername);
+  free(info->realname);
+  free(info->prefix);
+  pool_free(&infoPool, info);
+  pool_free(&clientPool, client);
+}
+
 channel_t *channel_alloc_init(char *channame){
     channel_t *newChannel;
-    newChannel = malloc(sizeof(channel_t));
+    newChannel = pool_alloc(&channelPool);
     if (!newChannel){
         DPRINTF(DEBUG_ERRS,"channel_alloc_init: failed to create channel entry");
         return NULL;
     }
     strncpy(newChannel->name,channame,MAX_CHANNAME);
-    newChannel->userlist = arraylist_create();
+    newChannel->name[MAX_CHANNAME] = '\0';
+    membervec_init(&newChannel->members);
+    if (idvec_size(&freeChannelIds) > 0)
+        newChannel->id = freeChannelIds.data[--freeChannelIds.size];
+    else
+        newChannel->id = nextChannelId++;
+    newChannel->gen = ++channelGeneration;
+    newChannel->workerMask = 0;
+    memset(newChannel->workerMembers, 0, sizeof(newChannel->workerMembers));
     INIT_STRING(newChannel->topic);
     INIT_STRING(newChannel->key);
     return newChannel;
 }
 
-extern fd_set master_set;
-extern fd_set write_set;
+void channel_free(channel_t *channel){
+    if (!channel)
+        return;
+    cursor_vec_gone(&channel->members.size);
+    membervec_free(&channel->members);
+    /* every member has left. a slice a lost REC_PART left behind under this id
+       is recognized by its older generation. if the id cannot be remembered,
+       it is just not reused */
+    idvec_push(&freeChannelIds, channel->id);
+    pool_free(&channelPool, channel);
+}
 
 /* remove client from our lists
  * NOTE: does not perform any IRC messaging thingys*/
-void remove_client(Arraylist clientList, int srcIndex){
-    int i;
-    client_t *client = CLIENT_GET(clientList,srcIndex);
+void remove_client(clientvec_t *clientList, chanvec_t *channelList, client_t *client){
+    int index = client->info->listIndex;
 
-    for (i=0;i<arraylist_size(client->chanlist);i++){
-        arraylist_remove(CHANNEL_GET(client->chanlist,i)->userlist,client); //remove users from all channel;
+    /* leave all channels, dropping the ones nobody is left on */
+    while (client->channels){
+        channel_t *channel = client->channels->channel;
+        removeMember(client->channels);
+        if (channel->members.size == 0)
+            remove_channel(channelList, channel);
     }
-    arraylist_remove(clientList,client);
-
-    freeOutbuf(client);
-    arraylist_free(client->chanlist);
-
-    close(client->sock);
-    FD_CLR(client->sock, &master_set);
-    FD_CLR(client->sock, &write_set);
+    cursor_removing(&clientList->size, index);
+    clientvec_swap_remove(clientList,index);
+    if (index < clientvec_size(clientList))
+        CLIENT_GET(clientList,index)->info->listIndex = index;
+    clientTable[client->sock] = NULL;
+    if (client->nick[0] != '\0')
+        hashtab_remove(nickTable,client);
 
-    free(client);
+    worker_post_close(client->worker, client->sock);
+    client_free(client);
 }
 
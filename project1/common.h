@@ -2,8 +2,10 @@
 #define _COMMON_H_
 
 #include <sys/types.h>
+#include <stddef.h>
 #include <netinet/in.h>
-#include "arraylist.h"
+#include "outq.h"
+#include "vec.h"
 
 
 /*
@@ -15,13 +17,17 @@
 #undef FALSE
 #define FALSE 0
 
+#undef Boolean
+#define Boolean short unsigned int
+
 static inline int max(int a, int b){
     return (a > b) ? a : b;
 }
 static inline int min(int a, int b){
     return (a < b) ? a : b;
 }
-#define MAX_CLIENTS 512
+#define MAX_CLIENTS 512 /* listen backlog. Number of clients is bounded by RLIMIT_NOFILE only */
+#define MAX_EVENT_FDS (1 << 20) /* upper bound of descriptors the event loop tracks */
 #define MAX_MSG_TOKENS 10
 #define MAX_MSG_LEN 512
 #define MAX_USERNAME 32
@@ -30,11 +36,13 @@ static inline int min(int a, int b){
 #define MAX_REALNAME 512
 #define MAX_CHANNAME 9
 #define MAX_NICKNAME 9
+#define DEFAULT_MAX_CHANNELS 50 /* channels a client may be on at once, unless -c is given */
+#define MAX_WORKERS 64 /* I/O worker threads (worker.h). fits client_t.worker */
 
 
 
-#define CLIENT_GET(LIST,INDEX) ((client_t *)arraylist_get((LIST),(INDEX)))
-#define CHANNEL_GET(LIST,INDEX) ((channel_t *)arraylist_get((LIST),(INDEX)))
+#define CLIENT_GET(LIST,INDEX) clientvec_get((LIST),(INDEX))
+#define CHANNEL_GET(LIST,INDEX) chanvec_get((LIST),(INDEX))
 
 #define INIT_STRING(STRING) (strcpy(STRING,""))
 
@@ -53,7 +61,8 @@ typedef enum {
     ERR_NOLOGIN = 444,
     ERR_NOTREGISTERED = 451,
     ERR_NEEDMOREPARAMS = 461,
-    ERR_ALREADYREGISTRED = 462
+    ERR_ALREADYREGISTRED = 462,
+    ERR_BADCHANNELKEY = 475
 } err_t;
 
 typedef enum {
@@ -73,30 +82,81 @@ typedef enum {
 
 
 
+typedef struct client_s client_t;
+typedef struct channel_s channel_t;
+typedef struct membership_s membership_t;
+
+/* one client being on one channel. Linked into the client's list of
+   channels and referenced from the channel's member array, so either side
+   can drop it in O(1) */
+struct membership_s {
+    client_t *client;
+    channel_t *channel;
+    int memberIndex;            /* position in channel->members */
+    membership_t *prev, *next;  /* client's channels */
+};
+
+typedef struct {
+    client_t *client;   /* copy of node->client: fan-out walks just this array */
+    membership_t *node;
+} member_t;
+
+VEC_DEFINE(membervec, member_t, 4)
+VEC_DEFINE(clientvec, client_t *, 4)
+VEC_DEFINE(chanvec, channel_t *, 4)
+
+/* ":nick!user@host" of a client, as it goes out in front of its messages */
+typedef struct {
+    unsigned short len;     /* of text */
+    unsigned short nickLen; /* of the ":nick" part, for the short form */
+    char text[];
+} prefix_t;
+
+/* rarely used per-client data, kept out of the hot part of client_t */
 typedef struct {
-    int sock;
     struct sockaddr_storage cliaddr; /*modified to handle both IPv4 and IPv6. */
-    unsigned inbuf_size;
-    int registered;
-    unsigned outbuf_offset;
-    Arraylist outbuf; /* array of char* lines to be send over */
-    char hostname[MAX_HOSTNAME+1];
-    char servername[MAX_SERVERNAME+1];
+    const char *hostname;   /* interned. numeric address until reverse DNS answers */
+    const char *servername; /* interned */
+    int listIndex;          /* position in clientList, for O(1) removal */
+    unsigned long serial;   /* tells this connection apart from later ones on the same socket */
+    prefix_t *prefix;       /* built on first use, dropped when nick, user or host change */
+    struct replygen_s *replies; /* long replies still being produced, oldest first */
+    char *realname;         /* heap copy, NULL until USER */
+    int hopcount; /*for project 2 */
     char user[MAX_USERNAME+1];
+} client_info_t;
+
+/* a client as the core sees it. The connection itself (socket buffers, out
+   queue) lives on the I/O worker that accepted it, see worker.h */
+struct client_s {
+    /* hot: touched by every command and fan-out. fits one cache line */
+    int sock;   /* descriptor of the connection, names it towards its worker */
+    unsigned visitEpoch; /* stamp of the last pass that visited this client, see beginVisit() */
+    unsigned registered : 1;
+    unsigned replying : 1; /* info->replies is not empty */
+    unsigned worker : 6; /* I/O worker owning the connection */
+    unsigned numChannels : 19;
     char nick[MAX_USERNAME+1];
-    char realname[MAX_REALNAME+1];
-    char inbuf[MAX_MSG_LEN+1];
-    int hopcount; /*for project 2 */
-    Arraylist chanlist;
-} client_t;
+    membership_t *channels; /* channels joined, most recent first */
+    client_info_t *info;
+};
 
+#define MAX_CHANNELS_LIMIT ((1 << 19) - 1) /* largest numChannels can count */
 
-typedef struct {
+_Static_assert(sizeof(client_t) <= 64, "client_t outgrew a cache line");
+
+struct channel_s {
     char name[MAX_CHANNAME+1];
     char topic[MAX_MSG_LEN+1];
     char key[MAX_CHANNAME+1];
-    Arraylist userlist;
-} channel_t;
+    membervec_t members; /* unordered, dense. small channels need no heap block */
+    int listIndex; /* position in channelList, for O(1) removal */
+    /* delivery: every worker holds the slice of members connected to it, see worker.h */
+    unsigned id; /* names the channel towards the workers. reused once freed */
+    unsigned long gen; /* tells this channel from earlier ones under the same id */
+    unsigned long long workerMask; /* workers with a non-empty slice */
+    unsigned workerMembers[MAX_WORKERS];
+};
 
 /** Function splitByDelimStr
  *
@@ -122,17 +182,83 @@ char **splitByDelimStr(const char *buf, const char *delimStr, int *numTokenPtr,
  */
 void freeTokens(char ***ptrToTokenArr, int numTokens);
 
-int findClientIndexBySockFD(Arraylist list, int sockfd);
-int findClientIndexByNick(Arraylist clientList, char *nickname);
-int findChannelIndexByChanname(Arraylist chanList, char *channame);
-int addClientToList(Arraylist list, char *servername, int sockfd, struct sockaddr_storage *remoteaddr);
+/* limit on channels per client, ERR_TOOMANYCHANNELS beyond it */
+extern int maxChannelsPerClient;
+
+/* fd-indexed table of connected clients, clientTableSize entries */
+extern client_t **clientTable;
+extern int clientTableSize;
+
+/* initClientTable: allocates clientTable for descriptors 0..size-1. -1 on error */
+int initClientTable(int size);
+/* initChannelIds: sets up the ids channels are named by towards the workers */
+void initChannelIds(void);
+
+/* findClientBySockFD: client connected on sockfd, NULL if none */
+static inline client_t *findClientBySockFD(int sockfd){
+    return (sockfd >= 0 && sockfd < clientTableSize) ? clientTable[sockfd] : NULL;
+}
+/* findClientByNick: client using nickname (RFC 1459 case-insensitive), NULL if none */
+client_t *findClientByNick(char *nickname);
+/* setClientNick: changes nick of client and re-indexes it. -1 if out of memory (client is left without nick) */
+int setClientNick(client_t *client, char *nickname);
+/* findChannelByName: channel called channame (RFC 1459 case-insensitive), NULL if none */
+channel_t *findChannelByName(char *channame);
+/* addChannelToList: registers a new channel in chanList and the name index. -1 on error */
+int addChannelToList(chanvec_t *chanList, channel_t *channel);
+/* remove_channel: unregisters channel and frees it. Members must have left already */
+void remove_channel(chanvec_t *chanList, channel_t *channel);
+
+/* addMember: puts client on channel, and into its worker's slice of it. NULL if out of memory */
+membership_t *addMember(channel_t *channel, client_t *client);
+/* membershipChanges: bumped by every addMember and removeMember. a pass spread over
+   several steps compares it to tell whether who shares a channel with whom changed */
+extern unsigned long membershipChanges;
+/* removeMember: takes the client of membership off its channel (and its worker's slice).
+ *               The channel is kept even if empty */
+void removeMember(membership_t *membership);
+/* findMember: membership of client on channel, NULL if not on it. O(channels of client) */
+membership_t *findMember(channel_t *channel, client_t *client);
 
-client_t *client_alloc_init(char *servername, int sockfd, struct sockaddr_storage *remoteaddr);
+/* visit epochs: a pass that must see each client once takes a fresh epoch
+   from beginVisit() and stamps the clients it reaches with markVisited().
+   a later pass invalidates the stamps, so a pass spread over several steps
+   checks visitEpoch to know whether its own are still there */
+extern unsigned visitEpoch; /* latest epoch handed out */
+unsigned beginVisit(void);
+
+/* markVisited: stamps client with epoch. FALSE if it already had it */
+static inline Boolean markVisited(client_t *client, unsigned epoch){
+    if (client->visitEpoch == epoch)
+        return FALSE;
+    client->visitEpoch = epoch;
+    return TRUE;
+}
+
+/* addClientToList: new client for connection sockfd of I/O worker worker. -1 on error (the
+ *                  worker is told to close the connection) */
+int addClientToList(clientvec_t *list, char *servername, int worker, int sockfd, unsigned long serial, struct sockaddr_storage *remoteaddr);
+
+client_t *client_alloc_init(char *servername, int worker, int sockfd, unsigned long serial, struct sockaddr_storage *remoteaddr);
 channel_t *channel_alloc_init(char *channame);
+/* channel_free: releases a channel made by channel_alloc_init. It must not be listed anymore */
+void channel_free(channel_t *channel);
+
+
+/* remove_client: forgets client and has its worker close the connection */
+void remove_client(clientvec_t *clientList, chanvec_t *channelList, client_t *client);
 
+/* clientPrefix: the client's message prefix. Never NULL */
+const prefix_t *clientPrefix(client_t *client);
+/* invalidateClientPrefix: to be called whenever nick, user or hostname change */
+void invalidateClientPrefix(client_t *client);
 
-void remove_client(Arraylist clientList, int srcIndex);
+/* resolveClientHost: starts the reverse lookup of a new client's address */
+void resolveClientHost(client_t *client);
+/* setResolvedHost: resolver callback. Names the client, if it is still connected */
+void setResolvedHost(int fd, unsigned long serial, const char *hostname);
 
-void freeOutbuf(client_t *client);
+/* client_free: releases everything client_alloc_init set up, not the connection */
+void client_free(client_t *client);
 
 #endif
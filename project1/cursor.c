@@ -0,0 +1,75 @@
+#include "cursor.h"
+
+static cursor_t *openCursors = NULL;
+
+static void *key_at(const cursor_t *cursor, int index){
+    return *(void **)((char *)*cursor->dataRef + (size_t)index * cursor->elemSize);
+}
+
+void cursor_open(cursor_t *cursor, void *const *dataRef, const int *sizeRef, size_t elemSize){
+    cursor->dataRef = dataRef;
+    cursor->sizeRef = sizeRef;
+    cursor->elemSize = elemSize;
+    cursor->next = 0;
+    ptrvec_init(&cursor->moved);
+    cursor->prev = NULL;
+    cursor->nextOpen = openCursors;
+    if (openCursors)
+        openCursors->prev = cursor;
+    openCursors = cursor;
+}
+
+void cursor_close(cursor_t *cursor){
+    if (cursor->prev)
+        cursor->prev->nextOpen = cursor->nextOpen;
+    else
+        openCursors = cursor->nextOpen;
+    if (cursor->nextOpen)
+        cursor->nextOpen->prev = cursor->prev;
+    ptrvec_free(&cursor->moved);
+}
+
+void *cursor_next(cursor_t *cursor){
+    if (!cursor->sizeRef)
+        return NULL;
+    if (cursor->moved.size > 0)
+        return ptrvec_swap_remove(&cursor->moved, cursor->moved.size - 1);
+    if (cursor->next < *cursor->sizeRef)
+        return key_at(cursor, cursor->next++);
+    return NULL;
+}
+
+void cursor_removing(const int *sizeRef, int index){
+    cursor_t *cursor;
+    int i, last = *sizeRef - 1;
+
+    for (cursor = openCursors; cursor; cursor = cursor->nextOpen){
+        if (cursor->sizeRef != sizeRef)
+            continue;
+        if (index < cursor->next){
+            void *removed = key_at(cursor, index);
+
+            /* a remembered element may be the one leaving */
+            for (i = 0; i < cursor->moved.size; i++){
+                if (cursor->moved.data[i] == removed){
+                    ptrvec_swap_remove(&cursor->moved, i);
+                    break;
+                }
+            }
+            /* the last element fills the hole: from ahead of the cursor to behind it */
+            if (last >= cursor->next)
+                ptrvec_push(&cursor->moved, key_at(cursor, last));
+        }
+        if (cursor->next > last)
+            cursor->next = last;
+    }
+}
+
+void cursor_vec_gone(const int *sizeRef){
+    cursor_t *cursor;
+
+    for (cursor = openCursors; cursor; cursor = cursor->nextOpen){
+        if (cursor->sizeRef == sizeRef)
+            cursor->sizeRef = NULL;
+    }
+}
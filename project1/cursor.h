@@ -0,0 +1,50 @@
+#ifndef _CURSOR_H_
+#define _CURSOR_H_
+
+#include "vec.h"
+
+/** CURSOR_H
+ *
+ *  Resumable walks over vectors that keep changing between steps
+ *  (clientList, channelList, a channel's members).
+ *
+ *  Those vectors remove in O(1) by moving the last element into the hole,
+ *  which would make a plain index skip elements. Open cursors are
+ *  registered, and the owner of the vector reports every removal with
+ *  cursor_removing() and the end of the vector with cursor_vec_gone().
+ *  An element that is moved from ahead of a cursor to behind it is
+ *  remembered by that cursor and visited anyway. Elements added while the
+ *  walk is on are visited too.
+ *
+ *  Every element visited is named by its first word, which must be a
+ *  pointer (client_t * and channel_t * lists, member_t of a channel).
+ **/
+
+VEC_DEFINE(ptrvec, void *, 2)
+
+typedef struct cursor_s {
+    void *const *dataRef;   /* &vec->data: the array may move as it grows */
+    const int *sizeRef;     /* &vec->size, also identifies the vector. NULL once it is gone */
+    size_t elemSize;
+    int next;               /* next index to visit */
+    ptrvec_t moved;         /* elements moved behind next before they were visited */
+    struct cursor_s *prev, *nextOpen; /* open cursors */
+} cursor_t;
+
+/* CURSOR_OPEN: starts a walk of vector vec, as made by VEC_DEFINE */
+#define CURSOR_OPEN(CURSOR, VEC) \
+    cursor_open((CURSOR), (void *const *)&(VEC)->data, &(VEC)->size, sizeof(*(VEC)->data))
+
+void cursor_open(cursor_t *cursor, void *const *dataRef, const int *sizeRef, size_t elemSize);
+void cursor_close(cursor_t *cursor);
+
+/* cursor_next: next element not visited yet, NULL at the end or if the vector is gone */
+void *cursor_next(cursor_t *cursor);
+
+/* cursor_removing: element index of the vector with size field *sizeRef is about to be
+ *                  swap-removed */
+void cursor_removing(const int *sizeRef, int index);
+/* cursor_vec_gone: the vector with size field *sizeRef is freed. Its walks end */
+void cursor_vec_gone(const int *sizeRef);
+
+#endif /* _CURSOR_H_ */
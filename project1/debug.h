@@ -29,6 +29,7 @@ extern unsigned int debug;
 #define DEBUG_CLIENTS   0x10    // DBTEXT:  Debug client arrival/depart
 #define DEBUG_COMMANDS  0x20    // DBTEXT:  Debug client commands
 #define DEBUG_CHANNELS  0x40    // DBTEXT:  Debug channel operations
+#define DEBUG_DNS       0x80    // DBTEXT:  Debug reverse DNS lookups
 
 #define DEBUG_ALL  0xffffffff
 
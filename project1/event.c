@@ -0,0 +1,374 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/select.h>
+#include <sys/epoll.h>
+#include "event.h"
+#include "debug.h"
+
+/*
+  constants
+*/
+#define EV_MAX_FIRED 1024 /* upper bound of events handed back per event_wait */
+
+/*
+  structures
+*/
+typedef struct {
+    const char *name;
+    int (*init)(event_loop_t *loop);
+    void (*free)(event_loop_t *loop);
+    /* apply interest change of fd to the kernel. newmask EV_NONE means forget fd */
+    int (*update)(event_loop_t *loop, int fd, int oldmask, int newmask);
+    /* fill fired with at most maxfired entries, return number of entries */
+    int (*wait)(event_loop_t *loop, ev_fired_t *fired, int maxfired, int timeout_ms);
+} ev_backend_t;
+
+struct event_loop_s {
+    const ev_backend_t *backend;
+    int setsize;
+    int *masks;        /* fd-indexed interest state */
+    int maxfd;         /* highest fd with non-empty mask. select backend only */
+    ev_fired_t *fired; /* room for nfired_max pending + nfired_max backend entries */
+    int nfired_max;
+    int *pendmask;     /* fd-indexed: events to re-deliver on next wait. see event_pend */
+    int *pendlist;     /* fds with non-empty pendmask */
+    int npending;
+    void *state;       /* backend private */
+};
+
+/*
+  epoll backend (edge triggered)
+*/
+typedef struct {
+    int epfd;
+    struct epoll_event *events;
+} ev_epoll_state_t;
+
+static int ev_epoll_init(event_loop_t *loop){
+    ev_epoll_state_t *state = malloc(sizeof(ev_epoll_state_t));
+    if (!state)
+        return -1;
+    state->events = malloc(sizeof(struct epoll_event) * loop->nfired_max);
+    if (!state->events){
+        free(state);
+        return -1;
+    }
+    state->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (state->epfd < 0){
+        DEBUG_PERROR("epoll_create1");
+        free(state->events);
+        free(state);
+        return -1;
+    }
+    loop->state = state;
+    return 0;
+}
+
+static void ev_epoll_free(event_loop_t *loop){
+    ev_epoll_state_t *state = loop->state;
+    close(state->epfd);
+    free(state->events);
+    free(state);
+}
+
+static int ev_epoll_update(event_loop_t *loop, int fd, int oldmask, int newmask){
+    ev_epoll_state_t *state = loop->state;
+    struct epoll_event ee;
+    int op;
+
+    memset(&ee, 0, sizeof(ee));
+    ee.data.fd = fd;
+    ee.events = EPOLLET;
+    if (newmask & EV_READ)
+        ee.events |= EPOLLIN;
+    if (newmask & EV_WRITE)
+        ee.events |= EPOLLOUT;
+
+    if (newmask == EV_NONE)
+        op = EPOLL_CTL_DEL;
+    else if (oldmask == EV_NONE)
+        op = EPOLL_CTL_ADD;
+    else
+        op = EPOLL_CTL_MOD; /* MOD re-arms the edge, so a newly wanted EV_WRITE fires at once if writable */
+
+    if (epoll_ctl(state->epfd, op, fd, &ee) < 0){
+        /* fd may already be gone from the set if it was closed before we were told */
+        if (op == EPOLL_CTL_DEL && (errno == EBADF || errno == ENOENT))
+            return 0;
+        DEBUG_PERROR("epoll_ctl");
+        return -1;
+    }
+    return 0;
+}
+
+static int ev_epoll_wait(event_loop_t *loop, ev_fired_t *fired, int maxfired, int timeout_ms){
+    ev_epoll_state_t *state = loop->state;
+    int i, n, numFired = 0;
+
+    n = epoll_wait(state->epfd, state->events, maxfired, timeout_ms);
+    if (n < 0)
+        return -1;
+
+    for (i = 0; i < n; i++){
+        struct epoll_event *e = &state->events[i];
+        int fd = e->data.fd;
+        int mask = EV_NONE;
+
+        if (e->events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+            mask |= EV_READ; /* hangups and errors surface through the read path */
+        if (e->events & (EPOLLOUT | EPOLLHUP | EPOLLERR))
+            mask |= EV_WRITE;
+        mask &= loop->masks[fd];
+        if (mask == EV_NONE)
+            continue;
+        fired[numFired].fd = fd;
+        fired[numFired].mask = mask;
+        numFired++;
+    }
+    return numFired;
+}
+
+/*
+  select backend (level triggered)
+*/
+typedef struct {
+    fd_set read_set;
+    fd_set write_set;
+    fd_set read_ready;   /* copies handed to select */
+    fd_set write_ready;
+} ev_select_state_t;
+
+static int ev_select_init(event_loop_t *loop){
+    ev_select_state_t *state = malloc(sizeof(ev_select_state_t));
+    if (!state)
+        return -1;
+    FD_ZERO(&state->read_set);
+    FD_ZERO(&state->write_set);
+    loop->state = state;
+    return 0;
+}
+
+static void ev_select_free(event_loop_t *loop){
+    free(loop->state);
+}
+
+static int ev_select_update(event_loop_t *loop, int fd, int oldmask, int newmask){
+    ev_select_state_t *state = loop->state;
+
+    if (newmask & EV_READ)
+        FD_SET(fd, &state->read_set);
+    else
+        FD_CLR(fd, &state->read_set);
+    if (newmask & EV_WRITE)
+        FD_SET(fd, &state->write_set);
+    else
+        FD_CLR(fd, &state->write_set);
+    return 0;
+}
+
+static int ev_select_wait(event_loop_t *loop, ev_fired_t *fired, int maxfired, int timeout_ms){
+    ev_select_state_t *state = loop->state;
+    struct timeval tv, *tvp = NULL;
+    int fd, retval, numFired = 0;
+
+    if (timeout_ms >= 0){
+        tv.tv_sec = timeout_ms / 1000;
+        tv.tv_usec = (timeout_ms % 1000) * 1000;
+        tvp = &tv;
+    }
+    state->read_ready = state->read_set;
+    state->write_ready = state->write_set;
+    retval = select(loop->maxfd + 1, &state->read_ready, &state->write_ready, NULL, tvp);
+    if (retval <= 0)
+        return retval;
+
+    for (fd = 0; fd <= loop->maxfd && numFired < maxfired; fd++){
+        int mask = EV_NONE;
+        if (FD_ISSET(fd, &state->read_ready))
+            mask |= EV_READ;
+        if (FD_ISSET(fd, &state->write_ready))
+            mask |= EV_WRITE;
+        if (mask == EV_NONE)
+            continue;
+        fired[numFired].fd = fd;
+        fired[numFired].mask = mask;
+        numFired++;
+    }
+    return numFired;
+}
+
+static const ev_backend_t backends[] = {
+    { "epoll",  ev_epoll_init,  ev_epoll_free,  ev_epoll_update,  ev_epoll_wait },
+    { "select", ev_select_init, ev_select_free, ev_select_update, ev_select_wait },
+};
+
+#define NELMS(array) (sizeof(array) / sizeof(array[0]))
+
+event_loop_t *event_loop_create(const char *backend, int setsize){
+    event_loop_t *loop;
+    int i;
+
+    if (!backend)
+        backend = EV_DEFAULT_BACKEND;
+
+    loop = malloc(sizeof(event_loop_t));
+    if (!loop){
+        DPRINTF(DEBUG_ERRS,"event_loop_create: failed to allocate loop\n");
+        return NULL;
+    }
+    loop->backend = NULL;
+    for (i = 0; i < NELMS(backends); i++){
+        if (!strcmp(backends[i].name, backend)){
+            loop->backend = &backends[i];
+            break;
+        }
+    }
+    if (!loop->backend){
+        DPRINTF(DEBUG_ERRS,"event_loop_create: unknown backend %s\n",backend);
+        free(loop);
+        return NULL;
+    }
+    if (loop->backend->init == ev_select_init && setsize > FD_SETSIZE){
+        DPRINTF(DEBUG_INIT,"event_loop_create: select backend limited to %d descriptors\n",FD_SETSIZE);
+        setsize = FD_SETSIZE;
+    }
+
+    loop->setsize = setsize;
+    loop->maxfd = -1;
+    loop->nfired_max = (setsize < EV_MAX_FIRED) ? setsize : EV_MAX_FIRED;
+    loop->masks = calloc(setsize, sizeof(int));
+    loop->fired = malloc(sizeof(ev_fired_t) * loop->nfired_max * 2);
+    loop->pendmask = calloc(setsize, sizeof(int));
+    loop->pendlist = malloc(sizeof(int) * loop->nfired_max);
+    loop->npending = 0;
+    if (!loop->masks || !loop->fired || !loop->pendmask || !loop->pendlist || loop->backend->init(loop) < 0){
+        DPRINTF(DEBUG_ERRS,"event_loop_create: failed to initialize %s backend\n",backend);
+        free(loop->masks);
+        free(loop->fired);
+        free(loop->pendmask);
+        free(loop->pendlist);
+        free(loop);
+        return NULL;
+    }
+    DPRINTF(DEBUG_INIT,"event_loop_create: using %s backend for %d descriptors\n",backend,setsize);
+    return loop;
+}
+
+void event_loop_free(event_loop_t *loop){
+    loop->backend->free(loop);
+    free(loop->masks);
+    free(loop->fired);
+    free(loop->pendmask);
+    free(loop->pendlist);
+    free(loop);
+}
+
+const char *event_loop_backend(event_loop_t *loop){
+    return loop->backend->name;
+}
+
+int event_loop_setsize(event_loop_t *loop){
+    return loop->setsize;
+}
+
+/* apply new interest set of fd, touching the kernel only if it changed */
+static int event_set_mask(event_loop_t *loop, int fd, int newmask){
+    int oldmask;
+
+    if (fd < 0 || fd >= loop->setsize){
+        DPRINTF(DEBUG_ERRS,"event_set_mask: fd %d out of range (setsize %d)\n",fd,loop->setsize);
+        errno = ERANGE;
+        return -1;
+    }
+    oldmask = loop->masks[fd];
+    if (oldmask == newmask)
+        return 0;
+    if (loop->backend->update(loop, fd, oldmask, newmask) < 0)
+        return -1;
+    loop->masks[fd] = newmask;
+
+    if (newmask != EV_NONE && fd > loop->maxfd){
+        loop->maxfd = fd;
+    }
+    else if (newmask == EV_NONE && fd == loop->maxfd){
+        while (loop->maxfd >= 0 && loop->masks[loop->maxfd] == EV_NONE)
+            loop->maxfd--;
+    }
+    return 0;
+}
+
+int event_add(event_loop_t *loop, int fd, int mask){
+    if (fd < 0 || fd >= loop->setsize)
+        return event_set_mask(loop, fd, mask);
+    return event_set_mask(loop, fd, loop->masks[fd] | mask);
+}
+
+int event_del(event_loop_t *loop, int fd, int mask){
+    if (fd < 0 || fd >= loop->setsize)
+        return event_set_mask(loop, fd, EV_NONE);
+    return event_set_mask(loop, fd, loop->masks[fd] & ~mask);
+}
+
+int event_get_mask(event_loop_t *loop, int fd){
+    if (fd < 0 || fd >= loop->setsize)
+        return EV_NONE;
+    return loop->masks[fd];
+}
+
+int event_pend(event_loop_t *loop, int fd, int mask){
+    if (fd < 0 || fd >= loop->setsize)
+        return -1;
+    if (loop->pendmask[fd] == EV_NONE){
+        if (loop->npending == loop->nfired_max)
+            return -1;
+        loop->pendlist[loop->npending++] = fd;
+    }
+    loop->pendmask[fd] |= mask;
+    return 0;
+}
+
+int event_wait(event_loop_t *loop, ev_fired_t **firedPtr, int timeout_ms){
+    int i, n, numFired = 0;
+
+    /* re-deliver what the caller left unfinished last round. pendmask holds the
+       slot (negated, minus one) while we merge, so the same fd is never reported twice */
+    for (i = 0; i < loop->npending; i++){
+        int fd = loop->pendlist[i];
+        int mask = loop->pendmask[fd] & loop->masks[fd];
+        loop->pendmask[fd] = EV_NONE;
+        if (mask == EV_NONE)
+            continue;
+        loop->fired[numFired].fd = fd;
+        loop->fired[numFired].mask = mask;
+        loop->pendmask[fd] = -(numFired + 1);
+        numFired++;
+    }
+    loop->npending = 0;
+
+    /* don't sleep while there is work left over */
+    n = loop->backend->wait(loop, loop->fired + numFired, loop->nfired_max, numFired ? 0 : timeout_ms);
+    if (n < 0 && numFired == 0)
+        return -1;
+
+    if (numFired){
+        int pendingFired = numFired;
+        for (i = pendingFired; i < pendingFired + n; i++){
+            ev_fired_t *e = &loop->fired[i];
+            if (loop->pendmask[e->fd] < 0)
+                loop->fired[-loop->pendmask[e->fd] - 1].mask |= e->mask;
+            else
+                loop->fired[numFired++] = *e;
+        }
+        for (i = 0; i < pendingFired; i++)
+            loop->pendmask[loop->fired[i].fd] = EV_NONE;
+    }
+    else{
+        numFired = n;
+    }
+
+    if (firedPtr)
+        *firedPtr = loop->fired;
+    return numFired;
+}
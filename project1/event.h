@@ -0,0 +1,55 @@
+#ifndef _EVENT_H_
+#define _EVENT_H_
+
+/** EVENT_H
+ *
+ *  Small readiness-notification layer the main loop is built on.
+ *
+ *  The loop keeps the interest mask of every descriptor it knows about in an
+ *  fd-indexed table, so backends only talk to the kernel when a mask actually
+ *  changes and only ready descriptors are ever handed back to the caller.
+ *
+ *  Backends:
+ *    "epoll"  - edge-triggered epoll (default). Callers must drain a ready
+ *               descriptor until EAGAIN before waiting again.
+ *    "select" - portable fallback, limited to FD_SETSIZE descriptors.
+ **/
+
+#define EV_NONE  0x0
+#define EV_READ  0x1
+#define EV_WRITE 0x2
+
+#define EV_DEFAULT_BACKEND "epoll"
+
+typedef struct {
+    int fd;
+    int mask; /* EV_READ and/or EV_WRITE that became ready (and are wanted) */
+} ev_fired_t;
+
+typedef struct event_loop_s event_loop_t;
+
+/* event_loop_create: creates loop able to watch descriptors 0..setsize-1.
+ *                    backend NULL selects EV_DEFAULT_BACKEND. NULL on error */
+event_loop_t *event_loop_create(const char *backend, int setsize);
+void event_loop_free(event_loop_t *loop);
+const char *event_loop_backend(event_loop_t *loop);
+int event_loop_setsize(event_loop_t *loop);
+
+/* event_add: adds mask to the interest set of fd. -1 on error */
+int event_add(event_loop_t *loop, int fd, int mask);
+/* event_del: removes mask from the interest set of fd. fd is forgotten once its mask is EV_NONE */
+int event_del(event_loop_t *loop, int fd, int mask);
+/* event_get_mask: current interest set of fd */
+int event_get_mask(event_loop_t *loop, int fd);
+
+/* event_pend: hand mask of fd back on the next event_wait without waiting for the kernel.
+ *             Used when a ready fd was not drained to EAGAIN (e.g. read budget spent),
+ *             since an edge-triggered backend would not report it again. -1 on error */
+int event_pend(event_loop_t *loop, int fd, int mask);
+
+/* event_wait: blocks for at most timeout_ms (-1 forever) and returns number of
+ *             entries stored in *firedPtr, or -1 on error (errno set).
+ *             The array stays valid until the next call. */
+int event_wait(event_loop_t *loop, ev_fired_t **firedPtr, int timeout_ms);
+
+#endif /* _EVENT_H_ */
@@ -0,0 +1,77 @@
+#ifndef _FMT_H_
+#define _FMT_H_
+
+#include <string.h>
+
+/** FMT_H
+ *
+ *  Append-only line formatter for outgoing messages, used instead of
+ *  snprintf on the send paths.
+ *
+ *    fmt_init(f, buf, size)   formats into buf, which holds size bytes with the NUL
+ *    fmt_mem(f, s, n)         appends n bytes of s
+ *    fmt_str(f, s)            appends a null terminated string
+ *    fmt_char(f, c)
+ *    fmt_uint(f, v)           appends v in decimal
+ *    fmt_cut(f)               TRUE once some output did not fit and was dropped
+ *    fmt_end(f)               terminates buf and returns it. length is f->len
+ *
+ *  Output that does not fit is cut, like snprintf would.
+ **/
+
+typedef struct {
+    char *buf;
+    unsigned len;
+    unsigned cap; /* size of buf, minus the NUL */
+    int cut;      /* output was dropped */
+} fmt_t;
+
+static inline void fmt_init(fmt_t *f, char *buf, unsigned size){
+    f->buf = buf;
+    f->len = 0;
+    f->cap = size - 1;
+    f->cut = 0;
+}
+
+static inline void fmt_mem(fmt_t *f, const char *s, unsigned n){
+    if (n > f->cap - f->len){
+        n = f->cap - f->len;
+        f->cut = 1;
+    }
+    memcpy(f->buf + f->len, s, n);
+    f->len += n;
+}
+
+static inline void fmt_str(fmt_t *f, const char *s){
+    fmt_mem(f, s, strlen(s));
+}
+
+static inline void fmt_char(fmt_t *f, char c){
+    if (f->len < f->cap)
+        f->buf[f->len++] = c;
+    else
+        f->cut = 1;
+}
+
+static inline void fmt_uint(fmt_t *f, unsigned v){
+    char digits[10];
+    int n = sizeof(digits);
+
+    do {
+        digits[--n] = '0' + v % 10;
+        v /= 10;
+    } while (v);
+    fmt_mem(f, digits + n, sizeof(digits) - n);
+}
+
+/* a line exactly as long as buf allows is not cut */
+static inline int fmt_cut(const fmt_t *f){
+    return f->cut;
+}
+
+static inline char *fmt_end(fmt_t *f){
+    f->buf[f->len] = '\0';
+    return f->buf;
+}
+
+#endif /* _FMT_H_ */
@@ -0,0 +1,183 @@
+#include <stdlib.h>
+#include <string.h>
+#include "hashtab.h"
+#include "debug.h"
+
+#define HASHTAB_MIN_CAPACITY 16 /* power of two */
+
+/* RFC 1459: 'A'..'^' fold to 'a'..'~', which covers A-Z and []\~ */
+#define FOLD(c) ((c) >= 'A' && (c) <= '^' ? (c) + ('a' - 'A') : (c))
+#define FOLD4(c) FOLD(c), FOLD((c) + 1), FOLD((c) + 2), FOLD((c) + 3)
+#define FOLD16(c) FOLD4(c), FOLD4((c) + 4), FOLD4((c) + 8), FOLD4((c) + 12)
+#define FOLD64(c) FOLD16(c), FOLD16((c) + 16), FOLD16((c) + 32), FOLD16((c) + 48)
+
+const unsigned char irc_casemap[256] = {
+    FOLD64(0), FOLD64(64), FOLD64(128), FOLD64(192)
+};
+
+#define SAME(c) (c)
+#define SAME4(c) SAME(c), SAME((c) + 1), SAME((c) + 2), SAME((c) + 3)
+#define SAME16(c) SAME4(c), SAME4((c) + 4), SAME4((c) + 8), SAME4((c) + 12)
+#define SAME64(c) SAME16(c), SAME16((c) + 16), SAME16((c) + 32), SAME16((c) + 48)
+
+static const unsigned char exact_casemap[256] = {
+    SAME64(0), SAME64(64), SAME64(128), SAME64(192)
+};
+
+typedef struct {
+    unsigned hash;  /* hash of the folded name, saves most string compares */
+    void *item;     /* NULL for a free slot */
+} hashtab_slot_t;
+
+struct hashtab_s {
+    hashtab_slot_t *slots;
+    unsigned capacity;  /* power of two */
+    unsigned size;
+    hashtab_key_fn keyof;
+    const unsigned char *casemap; /* irc_casemap, or exact_casemap for case-sensitive names */
+};
+
+static int mapped_strcmp(const unsigned char *casemap, const char *a, const char *b){
+    const unsigned char *p = (const unsigned char *)a;
+    const unsigned char *q = (const unsigned char *)b;
+
+    while (*p && casemap[*p] == casemap[*q]){
+        p++;
+        q++;
+    }
+    return casemap[*p] - casemap[*q];
+}
+
+int irc_strcasecmp(const char *a, const char *b){
+    return mapped_strcmp(irc_casemap, a, b);
+}
+
+/* FNV-1a over the folded name, with a final avalanche for the low bits we mask */
+static unsigned hash_name(const unsigned char *casemap, const char *name){
+    const unsigned char *p = (const unsigned char *)name;
+    unsigned h = 2166136261U;
+
+    for (; *p; p++)
+        h = (h ^ casemap[*p]) * 16777619U;
+    h ^= h >> 16;
+    h *= 0x85ebca6bU;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35U;
+    h ^= h >> 16;
+    return h;
+}
+
+static int hashtab_resize(hashtab_t *tab, unsigned newCapacity){
+    hashtab_slot_t *newSlots = calloc(newCapacity, sizeof(hashtab_slot_t));
+    unsigned i, mask = newCapacity - 1;
+
+    if (!newSlots){
+        DPRINTF(DEBUG_ERRS,"hashtab_resize: failed to allocate %u slots\n",newCapacity);
+        return -1;
+    }
+    for (i = 0; i < tab->capacity; i++){
+        unsigned j;
+        if (!tab->slots[i].item)
+            continue;
+        for (j = tab->slots[i].hash & mask; newSlots[j].item; j = (j + 1) & mask)
+            ;
+        newSlots[j] = tab->slots[i];
+    }
+    free(tab->slots);
+    tab->slots = newSlots;
+    tab->capacity = newCapacity;
+    return 0;
+}
+
+static hashtab_t *hashtab_create_mapped(hashtab_key_fn keyof, const unsigned char *casemap){
+    hashtab_t *tab = malloc(sizeof(hashtab_t));
+
+    if (!tab)
+        return NULL;
+    tab->slots = calloc(HASHTAB_MIN_CAPACITY, sizeof(hashtab_slot_t));
+    if (!tab->slots){
+        free(tab);
+        return NULL;
+    }
+    tab->capacity = HASHTAB_MIN_CAPACITY;
+    tab->size = 0;
+    tab->keyof = keyof;
+    tab->casemap = casemap;
+    return tab;
+}
+
+hashtab_t *hashtab_create(hashtab_key_fn keyof){
+    return hashtab_create_mapped(keyof, irc_casemap);
+}
+
+hashtab_t *hashtab_create_exact(hashtab_key_fn keyof){
+    return hashtab_create_mapped(keyof, exact_casemap);
+}
+
+void hashtab_free(hashtab_t *tab){
+    if (!tab)
+        return;
+    free(tab->slots);
+    free(tab);
+}
+
+int hashtab_size(hashtab_t *tab){
+    return tab->size;
+}
+
+void *hashtab_find(hashtab_t *tab, const char *name){
+    unsigned hash = hash_name(tab->casemap, name);
+    unsigned mask = tab->capacity - 1;
+    unsigned i;
+
+    for (i = hash & mask; tab->slots[i].item; i = (i + 1) & mask){
+        if (tab->slots[i].hash == hash && mapped_strcmp(tab->casemap, tab->keyof(tab->slots[i].item), name) == 0)
+            return tab->slots[i].item;
+    }
+    return NULL;
+}
+
+int hashtab_insert(hashtab_t *tab, void *item){
+    unsigned hash, mask, i;
+
+    /* keep load factor under 3/4 */
+    if ((tab->size + 1) * 4 > tab->capacity * 3){
+        if (tab->capacity > (~0u >> 2) || hashtab_resize(tab, tab->capacity * 2) < 0)
+            return -1;
+    }
+    hash = hash_name(tab->casemap, tab->keyof(item));
+    mask = tab->capacity - 1;
+    for (i = hash & mask; tab->slots[i].item; i = (i + 1) & mask)
+        ;
+    tab->slots[i].hash = hash;
+    tab->slots[i].item = item;
+    tab->size++;
+    return 0;
+}
+
+int hashtab_remove(hashtab_t *tab, const void *item){
+    unsigned mask = tab->capacity - 1;
+    unsigned i, j;
+
+    for (i = hash_name(tab->casemap, tab->keyof(item)) & mask; tab->slots[i].item != item; i = (i + 1) & mask){
+        if (!tab->slots[i].item)
+            return -1;
+    }
+
+    /* backward-shift: pull later entries of the probe run into the hole
+       unless that would move them in front of their home slot */
+    for (j = (i + 1) & mask; tab->slots[j].item; j = (j + 1) & mask){
+        unsigned home = tab->slots[j].hash & mask;
+        if (((j - home) & mask) >= ((j - i) & mask)){
+            tab->slots[i] = tab->slots[j];
+            i = j;
+        }
+    }
+    tab->slots[i].item = NULL;
+    tab->size--;
+
+    /* give memory back after a mass quit, with hysteresis against flapping */
+    if (tab->capacity > HASHTAB_MIN_CAPACITY && tab->size * 8 < tab->capacity)
+        hashtab_resize(tab, tab->capacity / 2);
+    return 0;
+}
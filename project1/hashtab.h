@@ -0,0 +1,49 @@
+#ifndef _HASHTAB_H_
+#define _HASHTAB_H_
+
+/** HASHTAB_H
+ *
+ *  Open-addressing hash index over items named by a string
+ *  (nicknames, channel names, interned strings).
+ *
+ *  Names compare with the RFC 1459 case mapping: besides A-Z, the
+ *  characters {}|^ are the lower case equivalents of []\~. Tables made by
+ *  hashtab_create_exact compare bytes as they are. The table only
+ *  stores item pointers; the name is read back through the keyof function
+ *  given at creation, so it must not change while the item is indexed.
+ *
+ *  Linear probing with backward-shift deletion: no tombstones, so lookups
+ *  stay short under constant insert/remove churn.
+ **/
+
+extern const unsigned char irc_casemap[256];
+
+static inline int irc_tolower(int c){
+    return irc_casemap[(unsigned char)c];
+}
+
+/* irc_strcasecmp: strcasecmp with the RFC 1459 case mapping */
+int irc_strcasecmp(const char *a, const char *b);
+
+typedef const char *(*hashtab_key_fn)(const void *item);
+
+typedef struct hashtab_s hashtab_t;
+
+/* hashtab_create: empty table of items named by keyof(item). NULL on error */
+hashtab_t *hashtab_create(hashtab_key_fn keyof);
+/* hashtab_create_exact: same, but names are case-sensitive */
+hashtab_t *hashtab_create_exact(hashtab_key_fn keyof);
+void hashtab_free(hashtab_t *tab);
+int hashtab_size(hashtab_t *tab);
+
+/* hashtab_find: item whose name case-folds equal to name, or NULL */
+void *hashtab_find(hashtab_t *tab, const char *name);
+
+/* hashtab_insert: indexes item under keyof(item). The name must not be in the table yet.
+ *                 -1 if out of memory */
+int hashtab_insert(hashtab_t *tab, void *item);
+
+/* hashtab_remove: drops item (compared by address) from the table. -1 if it was not there */
+int hashtab_remove(hashtab_t *tab, const void *item);
+
+#endif /* _HASHTAB_H_ */
@@ -0,0 +1,58 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include "intern.h"
+#include "hashtab.h"
+#include "debug.h"
+
+typedef struct {
+    int refcount;
+    char str[];
+} interned_t;
+
+#define INTERNED_OF(S) ((interned_t *)((char *)(S) - offsetof(interned_t, str)))
+
+static hashtab_t *internTable = NULL;
+
+static const char *interned_key(const void *entry){
+    return ((const interned_t *)entry)->str;
+}
+
+const char *intern_acquire(const char *s){
+    interned_t *entry;
+    size_t len;
+
+    if (!internTable && !(internTable = hashtab_create_exact(interned_key)))
+        return NULL;
+    entry = hashtab_find(internTable, s);
+    if (entry){
+        entry->refcount++;
+        return entry->str;
+    }
+
+    len = strlen(s);
+    entry = malloc(sizeof(interned_t) + len + 1);
+    if (!entry){
+        DPRINTF(DEBUG_ERRS,"intern_acquire: failed to allocate %lu bytes\n",(unsigned long)len);
+        return NULL;
+    }
+    entry->refcount = 1;
+    memcpy(entry->str, s, len + 1);
+    if (hashtab_insert(internTable, entry) < 0){
+        free(entry);
+        return NULL;
+    }
+    return entry->str;
+}
+
+void intern_release(const char *s){
+    interned_t *entry;
+
+    if (!s)
+        return;
+    entry = INTERNED_OF(s);
+    if (--entry->refcount == 0){
+        hashtab_remove(internTable, entry);
+        free(entry);
+    }
+}
@@ -0,0 +1,19 @@
+#ifndef _INTERN_H_
+#define _INTERN_H_
+
+/** INTERN_H
+ *
+ *  Refcounted table of shared, immutable strings.
+ *
+ *  Hostnames and servernames repeat across many clients (every local client
+ *  carries the same servername, clients behind one NAT the same hostname).
+ *  Each distinct string is stored once; clients hold a reference to it.
+ **/
+
+/* intern_acquire: shared copy of s, with one more reference. NULL if out of memory */
+const char *intern_acquire(const char *s);
+
+/* intern_release: drops a reference taken by intern_acquire. NULL is ignored */
+void intern_release(const char *s);
+
+#endif /* _INTERN_H_ */
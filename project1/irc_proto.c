@@ -7,9 +7,13 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include "common.h"
-#include "arraylist.h"
 
 #include "message.h"
+#include "scan.h"
+#include "fmt.h"
+#include "cursor.h"
+#include "replygen.h"
+#include "match.h"
 
 #define MAX_COMMAND 16
 
@@ -21,7 +25,7 @@
 * or however you set it up.
 */
 
-#define CMD_ARGS Arraylist clientList, int srcIndex, Arraylist channelList, char *servername, char *prefix, char **params, int n_params
+#define CMD_ARGS clientvec_t *clientList, client_t *sender, chanvec_t *channelList, char *servername, char *prefix, char **params, int n_params
 
 typedef void (*cmd_handler_t)(CMD_ARGS);
 #define COMMAND(cmd_name) void cmd_name(CMD_ARGS)
@@ -47,10 +51,14 @@ COMMAND(cmd_part);
 COMMAND(cmd_list);
 COMMAND(cmd_privmsg);
 COMMAND(cmd_who);
+COMMAND(cmd_names);
 
 /* helper functions */
-void part_client(client_t *sender,char *servername, char *channame, Arraylist chanList);
-void part_client_given_channel(client_t * client, char *servername, channel_t *theChannel, Arraylist chanList);
+void join_client(client_t *sender, char *servername, char *channame, char *key, chanvec_t *chanList);
+void send_names(client_t *receiver, char *servername, channel_t *theChannel);
+void part_client(client_t *sender,char *servername, char *channame, chanvec_t *chanList, char *message);
+void part_client_given_channel(client_t * client, char *servername, channel_t *theChannel, chanvec_t *chanList, char *message);
+static void leave_channel(client_t *sender, membership_t *membership, chanvec_t *chanList, char *message);
 
 
 
@@ -70,130 +78,164 @@ struct dispatch cmds[] = {
     { "LIST",    1, 0, cmd_list },
     { "PRIVMSG", 1, 0, cmd_privmsg },
     { "WHO",     1, 0, cmd_who },
+    { "NAMES",   1, 0, cmd_names },
     /* Fill in the blanks... */
 };
 
-/* Handle a command line.  NOTE:  You will probably want to
-* modify the way this function is called to pass in a client
-* pointer or a table pointer or something of that nature
-* so you know who to dispatch on...
-* Mostly, this is here to do the parsing and dispatching
-* for you
-*
-* This function takes a single line of text.  You MUST have
-* ensured that it's a complete line (i.e., don't just pass
-* it the result of calling read()).
-* Strip the trailing newline off before calling this function.
+/* Lookup table for cmds[]. cmd-hash.h is generated from the table above by
+* cmdhash.pl: a minimal perfect hash, so a command is found (or rejected)
+* with two hashes and one key compare instead of a strcasecmp per entry.
 */
-void handle_line_temp(Arraylist clientList, int srcIndex, char *servername, char *line){
-    int lineLen = strlen(line);
-    char *copy = malloc( sizeof(char) * (lineLen + 2 + 1));
+struct cmd_hash_entry {
+    unsigned long long key[2]; /* upper-cased name, packed little-endian */
+    int needreg;
+    int minparams;
+    cmd_handler_t handler;
+};
 
-    memcpy(copy,line,lineLen);
-    strcpy(copy+lineLen,"\r\n");
+#include "cmd-hash.h"
 
-    client_t *sender = arraylist_get(clientList, srcIndex);
-    arraylist_add(sender->outbuf,copy);
+static unsigned cmd_hash_mix(unsigned h)
+{
+    h ^= h >> 16;
+    h *= 0x85ebca6bU;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35U;
+    h ^= h >> 16;
+    return h;
 }
-void handle_line(Arraylist clientList, int srcIndex, Arraylist channelList, char *servername, char *line)
+
+/** Function cmd_lookup
+ *  ---------------------------------------------------------------
+ *  Finds the dispatch entry of command, case-insensitively.
+ *  Must hash exactly like fnv() in cmdhash.pl.
+ *  @return the entry, or NULL for an unknown command
+ **/
+static const struct cmd_hash_entry *cmd_lookup(const char *command)
+{
+    unsigned long long key[2] = { 0, 0 };
+    unsigned char name[MAX_COMMAND];
+    unsigned h, seed;
+    int i, len;
+    const struct cmd_hash_entry *e;
+
+    for (len = 0; command[len]; len++) {
+        unsigned char c = command[len];
+        if (len == MAX_COMMAND - 1)
+            return NULL;
+        if (c >= 'a' && c <= 'z')
+            c -= 'a' - 'A';
+        name[len] = c;
+        key[len / 8] |= (unsigned long long)c << (8 * (len % 8));
+    }
+
+    h = 2166136261U;
+    for (i = 0; i < len; i++)
+        h = (h ^ name[i]) * 16777619U;
+    seed = cmd_hash_disp[cmd_hash_mix(h) % CMD_HASH_NBUCKETS];
+
+    h = 2166136261U ^ seed;
+    for (i = 0; i < len; i++)
+        h = (h ^ name[i]) * 16777619U;
+    e = &cmd_hash_table[cmd_hash_mix(h) % CMD_HASH_NKEYS];
+
+    if (e->key[0] != key[0] || e->key[1] != key[1])
+        return NULL;
+    return e;
+}
+
+/* parse_scanned_line: splits a line framed by linescan. It needs no client, so it runs on the I/O workers */
+void parse_scanned_line(scanned_line_t *scanned, parsed_line_t *parsed)
 {
-    char *prefix = NULL, *command, *pstart, *params[MAX_MSG_TOKENS];
-    int n_params = 0;
+    char *line = scanned->line;
     char *trailing = NULL;
+    unsigned tokenStart = 0; /* start of the word being collected */
+    int k = 0;
 
-    client_t *sender = arraylist_get(clientList,srcIndex);
+    parsed->prefix = NULL;
+    parsed->command = NULL;
+    parsed->cmd = NULL;
+    parsed->n_params = 0;
 
     DPRINTF(DEBUG_INPUT, "Handling line: %s\n", line);
-    command = line;
     if (*line == ':') {
-        prefix = ++line;
-        command = strchr(prefix, ' ');
+        parsed->prefix = line + 1;
+        tokenStart = 1;
+        k = 1; /* that ':' is delims[0] */
     }
-    if (!command || *command == '\0') {
-        /* Send an unknown command error! */
-        //some_of_your_code_better_go_here();
-        params[0] = "No Command Specified";
-        sendNumericReply(sender, servername, ERR_UNKNOWNCOMMAND, params, 1);
-        return;
+
+    /* every delimiter is either a SPACE ending a word, or a ':' - which opens
+       the trailing parameter if it starts a word after the command */
+    for (; k <= scanned->numDelims; k++) {
+        unsigned p = (k < scanned->numDelims) ? scanned->delims[k] - scanned->base : scanned->len;
+        char *word = line + tokenStart;
+
+        if (p < scanned->len && line[p] == ':') {
+            if (p == tokenStart && parsed->command) {
+                trailing = line + p + 1;
+                break;
+            }
+            continue;
+        }
+        line[p] = '\0';
+        tokenStart = p + 1;
+        if (*word == '\0')
+            continue; /* run of spaces */
+
+        if (parsed->prefix && word == parsed->prefix)
+            continue;
+        if (!parsed->command)
+            parsed->command = word;
+        else if (parsed->n_params < MAX_MSG_TOKENS)
+            parsed->params[parsed->n_params++] = word;
     }
 
-    while (*command == ' ') {
-        *command++ = 0;
+    if (!parsed->command)
+        return;
+
+    if (trailing && parsed->n_params < MAX_MSG_TOKENS) {
+        parsed->params[parsed->n_params++] = trailing;
     }
-    if (*command == '\0') {
-        //and_more_of_your_code_should_go_here();
+    parsed->cmd = cmd_lookup(parsed->command);
+}
+
+/* dispatch_line: runs the command of a parsed line for sender */
+void dispatch_line(clientvec_t *clientList, client_t *sender, chanvec_t *channelList, char *servername, parsed_line_t *parsed)
+{
+    const struct cmd_hash_entry *cmd = parsed->cmd;
+    char *command = parsed->command;
+    char **params = parsed->params;
+    int n_params = parsed->n_params;
+    int i;
+
+    if (!command) {
         /* Send an unknown command error! */
         params[0] = "No Command Specified";
         sendNumericReply(sender, servername, ERR_UNKNOWNCOMMAND, params, 1);
         return;
     }
-    pstart = strchr(command, ' ');
-    if (pstart) {
-        while (*pstart == ' ') {
-            *pstart++ = '\0';
-        }
-        if (*pstart == ':') {
-            trailing = pstart;
-        } else {
-            trailing = strstr(pstart, " :");
-        }
-        if (trailing) {
-            while (*trailing == ' ')
-            *trailing++ = 0;
-            if (*trailing == ':')
-            *trailing++ = 0;
-        }
-
-        do {
-            if (*pstart != '\0') {
-                params[n_params++] = pstart;
-            } else {
-                break;
-            }
-            pstart = strchr(pstart, ' ');
-            if (pstart) {
-                while (*pstart == ' ') {
-                    *pstart++ = '\0';
-                }
-            }
-        } while (pstart != NULL && n_params < MAX_MSG_TOKENS);
-    }
-
-    if (trailing && n_params < MAX_MSG_TOKENS) {
-        params[n_params++] = trailing;
-    }
 
     DPRINTF(DEBUG_INPUT, "Prefix:  %s\nCommand: %s\nParams (%d):\n",
-    prefix ? prefix : "<none>", command, n_params);
-    int i;
+    parsed->prefix ? parsed->prefix : "<none>", command, n_params);
     for (i = 0; i < n_params; i++) {
         DPRINTF(DEBUG_INPUT, "   %s\n", params[i]);
     }
     DPRINTF(DEBUG_INPUT, "\n");
 
-    for (i = 0; i < NELMS(cmds); i++) {
-        if (!strcasecmp(cmds[i].cmd, command)) {
-            if (cmds[i].needreg && !(sender->registered) ) {
-                params[0] = "You have not registered";
-                sendNumericReply(sender, servername, ERR_NOTREGISTERED, params, 1);
-                return;
-            } else if (n_params < cmds[i].minparams) {
-                params[0] = command;
-                params[1] = "Not enough parameters";
-                sendNumericReply(sender, servername, ERR_NEEDMOREPARAMS, params, 2);
-                return;
-            } else {
-                (*cmds[i].handler)(clientList, srcIndex, channelList, servername, prefix, params, n_params);
-            }
-            break;
-        }
-    }
-    if (i == NELMS(cmds)) {
+    if (cmd == NULL) {
         /* ERROR - unknown command! */
-        //yet_again_you_should_put_code_here();
         params[0] = command;
         params[1] = "Unknown Command";
         sendNumericReply(sender, servername, ERR_UNKNOWNCOMMAND, params, 2);
+    } else if (cmd->needreg && !(sender->registered) ) {
+        params[0] = "You have not registered";
+        sendNumericReply(sender, servername, ERR_NOTREGISTERED, params, 1);
+    } else if (n_params < cmd->minparams) {
+        params[0] = command;
+        params[1] = "Not enough parameters";
+        sendNumericReply(sender, servername, ERR_NEEDMOREPARAMS, params, 2);
+    } else {
+        (*cmd->handler)(clientList, sender, channelList, servername, parsed->prefix, params, n_params);
     }
 }
 
@@ -203,8 +245,6 @@ void handle_line(Arraylist clientList, int srcIndex, Arraylist channelList, char
 /* MODIFY to take the arguments you specified above! */
 void cmd_nick(CMD_ARGS)
 {
-    int i,j;
-    client_t *sender = CLIENT_GET(clientList,srcIndex);
     char *messageArgs[MAX_MSG_TOKENS];
     char *newNick = params[0]; /* an alias for code readability */
 
@@ -224,38 +264,30 @@ void cmd_nick(CMD_ARGS)
         return;
     }
 
-    /* look for duplicate nick names */
-    int numClient = arraylist_size(clientList);
-    for (i=0;i<numClient;i++){
-        client_t *other = CLIENT_GET(clientList,i);
-        if (strcasecmp(newNick,other->nick) == 0){
-            messageArgs[0] = newNick;
-            messageArgs[1] = "Nickname is already in use";
-            sendNumericReply(sender, servername, ERR_NICKNAMEINUSE, messageArgs, 2);
-            return;
-        }
+    /* look for duplicate nick names. changing the case of one's own nick is fine */
+    client_t *other = findClientByNick(newNick);
+    if (other && other != sender){
+        messageArgs[0] = newNick;
+        messageArgs[1] = "Nickname is already in use";
+        sendNumericReply(sender, servername, ERR_NICKNAMEINUSE, messageArgs, 2);
+        return;
     }
 
 
     /* registered and in a channel. i.e. Nick change situation*/
-    if (sender->registered && (arraylist_size(sender->chanlist) != 0)){
-
-        for (i=0;i<arraylist_size(sender->chanlist);i++){
-            channel_t *thisChannel = CHANNEL_GET(sender->chanlist,i);
-            for (j = 0; j < arraylist_size(thisChannel->userlist); j++){
-                client_t *receiver = CLIENT_GET(thisChannel->userlist,j);
-                if (receiver != sender){
-                    sendNICK(receiver, sender, sender->nick, newNick);
-                }
-            }
-        }
+    if (sender->registered && sender->channels){
+        char buf[MAX_CONTENT_LENGTH+1];
+
+        formatNICK(buf, sizeof buf, sender, newNick);
+        sendToPeers(sender, FALSE, buf);
     }
 
     /* add nick */
-    strcpy(sender->nick,newNick);
+    if (setClientNick(sender,newNick) < 0)
+        return;
 
     /* now registered case */
-    if ((sender->registered == FALSE) && (strlen(sender->user) != 0)){
+    if ((sender->registered == FALSE) && (sender->info->user[0] != '\0')){
         sender->registered = TRUE;
         sendMOTD(sender,servername);
     }
@@ -264,17 +296,17 @@ void cmd_nick(CMD_ARGS)
 void cmd_user(CMD_ARGS)
 {
     char *messageArgs[MAX_MSG_TOKENS];
-    /* Arraylist clientList, int srcIndex, char *servername, char *prefix, char **params, int n_params */
-    client_t *sender = CLIENT_GET(clientList,srcIndex);
-    if (sender->user[0] != '\0'){
+    if (sender->info->user[0] != '\0'){
         messageArgs[0] = "You may not register";
         sendNumericReply(sender, servername, ERR_ALREADYREGISTRED, messageArgs, 1);
         return;
     }
 
-    strncpy(sender->user, params[0], MAX_USERNAME - 1);
-    sender->user[MAX_USERNAME-1] = '\0';
-    strncpy(sender->realname, params[3], MAX_REALNAME - 1);
+    strncpy(sender->info->user, params[0], MAX_USERNAME - 1);
+    sender->info->user[MAX_USERNAME-1] = '\0';
+    invalidateClientPrefix(sender);
+    free(sender->info->realname);
+    sender->info->realname = strndup(params[3], MAX_REALNAME - 1);
 
     if (!sender->registered && sender->nick[0] != '\0'){
         sender->registered = TRUE;
@@ -287,54 +319,81 @@ void cmd_user(CMD_ARGS)
 
 void cmd_quit(CMD_ARGS)
 {
-    int i,j;
-    client_t *sender = CLIENT_GET(clientList,srcIndex);
     char *message = ( n_params > 0) ? params[0] : "Bye Bye";
 
     DPRINTF(DEBUG_CLIENTS,"client %d entered cmd_quit\n",sender->sock);
 
-    if (sender->registered && arraylist_size(sender->chanlist) != 0){
-        for (i=0;i<arraylist_size(sender->chanlist);i++){
-            channel_t *thisChannel = CHANNEL_GET(sender->chanlist,i);
-            for (j=0; j<arraylist_size(thisChannel->userlist); j++){
-                client_t *receiver = CLIENT_GET(thisChannel->userlist,j);
-                if (receiver != sender){
-                    sendQUIT(receiver,sender,message);
-                }
-            }
-        }
+    if (sender->registered && sender->channels){
+        char buf[MAX_CONTENT_LENGTH+1];
+
+        formatQUIT(buf, sizeof buf, sender, message);
+        sendToPeers(sender, FALSE, buf);
     }
-    remove_client(clientList,srcIndex);
+    remove_client(clientList,channelList,sender);
 }
 
 void cmd_join(CMD_ARGS)
 {
-    int i=0;
-    client_t *sender = CLIENT_GET(clientList,srcIndex);
-    int numChanname;
+    int i;
+    int numChanname = 0, numKey = 0;
+    char **channames, **keys = NULL;
+
+    /* JOIN 0: leave all channels. each one needs its own PART line, so
+       the memberships are used directly rather than looked up by channel */
+    if (strcmp(params[0],"0") == 0){
+        while (sender->channels){
+            leave_channel(sender,sender->channels,channelList,NULL);
+        }
+        return;
+    }
+
     /* no need for tokens to be terminated so we give NULL for last parameter */
-    char **channames = splitByDelimStr(params[0],",",&numChanname,NULL);
+    channames = splitByDelimStr(params[0],",",&numChanname,NULL);
+    if (n_params > 1){
+        keys = splitByDelimStr(params[1],",",&numKey,NULL);
+    }
+
+    /* keys pair up with channels in order */
+    for (i = 0; i < numChanname; i++){
+        join_client(sender,servername,channames[i],(i < numKey) ? keys[i] : NULL,channelList);
+    }
+
+    if (channames){
+        freeTokens(&channames,numChanname);
+    }
+    if (keys){
+        freeTokens(&keys,numKey);
+    }
+}
+
+void join_client(client_t *sender, char *servername, char *channame, char *key, chanvec_t *chanList){
     char *messageArgs[MAX_MSG_TOKENS];
     char buf[MAX_CONTENT_LENGTH+1];
+    const prefix_t *prefix;
+    fmt_t f;
+    channel_t *theChannel = findChannelByName(channame);
 
-    /* only one channel allowed for now */
-    /*for (i = 0; i < numTokens; i++){*/
-    char *channame = channames[i];
-    int chanIndex = findChannelIndexByChanname(channelList,channame);
-    channel_t *theChannel;
-    
-    if (chanIndex >= 0){ /* there's already a channel with that name */
-        theChannel = CHANNEL_GET(channelList,chanIndex);
+    if (theChannel){ /* there's already a channel with that name */
         /* check if the user is already in that channel*/
-        if (arraylist_index_of(sender->chanlist,theChannel) >= 0){
-            if (numChanname){
-                freeTokens(&channames,numChanname);
-            }
+        if (findMember(theChannel,sender)){
             return;
-            /* continue; // if more than one channel allowed */
         }
+        if (theChannel->key[0] != '\0' && (!key || strcmp(key,theChannel->key) != 0)){
+            messageArgs[0] = theChannel->name;
+            messageArgs[1] = "Cannot join channel (+k)";
+            sendNumericReply(sender, servername, ERR_BADCHANNELKEY, messageArgs, 2);
+            return;
+        }
+    }
+
+    if (sender->numChannels >= maxChannelsPerClient){
+        messageArgs[0] = channame;
+        messageArgs[1] = "You have joined too many channels";
+        sendNumericReply(sender, servername, ERR_TOOMANYCHANNELS, messageArgs, 2);
+        return;
     }
-    else {
+
+    if (!theChannel){
         /* no existing channel with that name */
         /* verify validity of channame */
         if (!isValidChanname(channame)){
@@ -345,66 +404,63 @@ void cmd_join(CMD_ARGS)
         }
         /* create channel */
         theChannel = channel_alloc_init(channame);
-        if (theChannel){
-            chanIndex = arraylist_add(channelList,theChannel);
-        }
         /* not able to alloc new Channel or add to the list */
-        if (!theChannel || chanIndex < 0){
+        if (!theChannel || addChannelToList(chanList,theChannel) < 0){
+            channel_free(theChannel);
             messageArgs[0] = channame;
             messageArgs[1] = "Cannot join channel (+l)";
             sendNumericReply(sender, servername, ERR_TOOMANYCHANNELS, messageArgs, 2);
             return;
         }
-
     }
 
     /* add user to channel */
-    arraylist_add(theChannel->userlist,sender);
-
-    if (arraylist_size(sender->chanlist) != 0){
-        /* remove user from previous channel */
-        /* only applies one channel allowed condition */
-
-        part_client_given_channel(sender,servername,CHANNEL_GET(sender->chanlist,0),channelList);
-    }
-    arraylist_add(sender->chanlist,theChannel);
-
-    strcpy(buf,CLIENT_GET(theChannel->userlist,0)->nick); /* guaranteed to have at least one user */
-    char *temp = buf + strlen(buf);
-    for (i = 1; i < arraylist_size(theChannel->userlist ); i++){
-        size_t nWritten = snprintf(temp,sizeof buf - (temp - buf), " %s",CLIENT_GET(theChannel->userlist,i)->nick);
-        temp += nWritten;
-        if (temp >= buf + sizeof buf ){
-            buf[sizeof buf - 1] = '\0';
-            break;
+    if (!addMember(theChannel,sender)){
+        if (theChannel->members.size == 0){
+            remove_channel(chanList,theChannel);
         }
+        messageArgs[0] = channame;
+        messageArgs[1] = "Cannot join channel (+l)";
+        sendNumericReply(sender, servername, ERR_TOOMANYCHANNELS, messageArgs, 2);
+        return;
     }
-    messageArgs[0] = theChannel->name;
-    messageArgs[1] = buf;
-    sendNumericReply(sender, servername, RPL_NAMREPLY, messageArgs,2);
-    messageArgs[1] = "End of /NAMES list";
-    sendNumericReply(sender, servername, RPL_ENDOFNAMES, messageArgs, 2);
 
-    snprintf(buf,sizeof buf, ":%s JOIN %s",sender->nick,channame);
-    sendChannelBroadcast(sender,CHANNEL_GET(channelList,chanIndex), TRUE, buf);
+    send_names(sender,servername,theChannel);
 
+    prefix = clientPrefix(sender);
+    fmt_init(&f, buf, sizeof buf);
+    fmt_mem(&f, prefix->text, prefix->nickLen);
+    fmt_mem(&f, " JOIN ", 6);
+    fmt_str(&f, channame);
+    sendChannelBroadcast(sender,theChannel, TRUE, fmt_end(&f));
+}
 
+static void send_end_of_names(client_t *receiver, char *servername, char *channame){
+    char *messageArgs[MAX_MSG_TOKENS];
 
+    messageArgs[0] = channame;
+    messageArgs[1] = "End of /NAMES list";
+    sendNumericReply(receiver, servername, RPL_ENDOFNAMES, messageArgs, 2);
+}
 
-    /* }*/
+/* RPL_NAMREPLY lines for one channel, straight from its member array. Sent on JOIN */
+void send_names(client_t *receiver, char *servername, channel_t *theChannel){
+    namespack_t pack;
+    int i;
 
-    if (numChanname){
-        freeTokens(&channames, numChanname);
+    namesBegin(&pack, servername, theChannel->name);
+    for (i = 0; i < theChannel->members.size; i++){
+        namesAdd(receiver, &pack, theChannel->members.data[i].client->nick);
     }
-
+    namesFlush(receiver, &pack);
+    send_end_of_names(receiver, servername, theChannel->name);
 }
 
-void part_client(client_t *sender,char *servername, char *channame, Arraylist chanList){
+void part_client(client_t *sender,char *servername, char *channame, chanvec_t *chanList, char *message){
     char *messageArgs[MAX_MSG_TOKENS];
-    int chanIndex = findChannelIndexByChanname(chanList, channame);
-    channel_t *theChannel;
+    channel_t *theChannel = findChannelByName(channame);
     /* see if channel exists */
-    if ( chanIndex == -1){
+    if (!theChannel){
         /*send ERR_NOSUCHCHANNEL */
         messageArgs[0] = channame;
         messageArgs[1] = "No such channel";
@@ -412,36 +468,49 @@ void part_client(client_t *sender,char *servername, char *channame, Arraylist ch
         sendNumericReply(sender, servername, ERR_NOSUCHCHANNEL, messageArgs, 2);
         return;
     }
-    theChannel = CHANNEL_GET(chanList,chanIndex);
-
-    part_client_given_channel(sender, servername, theChannel, chanList);
+    part_client_given_channel(sender, servername, theChannel, chanList, message);
 }
-void part_client_given_channel(client_t *sender, char *servername, channel_t *theChannel, Arraylist chanList){
+void part_client_given_channel(client_t *sender, char *servername, channel_t *theChannel, chanvec_t *chanList, char *message){
     char *messageArgs[MAX_MSG_TOKENS];
-    int i;
+    membership_t *membership = findMember(theChannel,sender);
 
     /* see if user is part of that channel */
-    if ( arraylist_index_of(theChannel->userlist,sender) == -1){
+    if (!membership){
         /*send ERR_NONONCHANNEL*/
         messageArgs[0] = theChannel->name;
         messageArgs[1] = "You're not on that channel";
 
         sendNumericReply(sender, servername, ERR_NOTONCHANNEL, messageArgs, 2);
+        return;
     }
-    /* echo QUIT message to users */
-    for (i = 0; i < arraylist_size(theChannel->userlist); i++){
-        sendQUIT(CLIENT_GET(theChannel->userlist,i),sender,"Bye Bye");
+    leave_channel(sender, membership, chanList, message);
+}
+
+/* leave_channel: client of membership parts its channel, telling the members */
+static void leave_channel(client_t *sender, membership_t *membership, chanvec_t *chanList, char *message){
+    channel_t *theChannel = membership->channel;
+    char buf[MAX_CONTENT_LENGTH+1];
+    const prefix_t *prefix;
+    fmt_t f;
+
+    /* echo PART message to users, the leaving one included */
+    prefix = clientPrefix(sender);
+    fmt_init(&f, buf, sizeof buf);
+    fmt_mem(&f, prefix->text, prefix->len);
+    fmt_mem(&f, " PART ", 6);
+    fmt_str(&f, theChannel->name);
+    if (message){
+        fmt_mem(&f, " :", 2);
+        fmt_str(&f, message);
     }
+    sendChannelBroadcast(sender,theChannel,TRUE,fmt_end(&f));
 
     /* remove user from channel */
-    arraylist_remove(theChannel->userlist,sender);
-    arraylist_remove(sender->chanlist,theChannel);
+    removeMember(membership);
 
     /* remove channel from chanList if no one in channel */
-    if (arraylist_size(theChannel->userlist) == 0){
-        arraylist_free(theChannel->userlist);
-        arraylist_remove(chanList, theChannel);
-        free(theChannel);
+    if (theChannel->members.size == 0){
+        remove_channel(chanList, theChannel);
     }
 }
 
@@ -449,54 +518,72 @@ void part_client_given_channel(client_t *sender, char *servername, channel_t *th
 
 void cmd_part(CMD_ARGS)
 {
-    client_t *sender = CLIENT_GET(clientList,srcIndex);
-    int numTokens;
+    int numTokens = 0;
     char **tokens = splitByDelimStr(params[0],",",&numTokens,NULL);
+    char *message = (n_params > 1) ? params[1] : NULL;
 
     int i;
     for (i=0;i<numTokens;i++){
-        part_client(sender,servername,tokens[i],channelList);
+        part_client(sender,servername,tokens[i],channelList,message);
     }
 
-    freeTokens(&tokens,numTokens);
+    if (tokens){
+        freeTokens(&tokens,numTokens);
+    }
 }
 
 
 
+/* RPL_LIST for every channel, as the client reads them */
+static Boolean list_step(client_t *client, replygen_t *gen){
+    char buf[32]; /* arbitrary number. I will only hold '# of users' in text */
+    char *messageArgs[MAX_MSG_TOKENS];
+    channel_t *thisChannel;
+    fmt_t f;
+
+    messageArgs[1] = buf; /* second argument will always be present in buf */
+    while (replygen_room(client)){
+        if (!(thisChannel = cursor_next(&gen->cursor))){
+            /* RPL_LISTEND */
+            messageArgs[0] = "End of /LIST";
+            sendNumericReply(client,gen->servername,RPL_LISTEND,messageArgs,1);
+            return TRUE;
+        }
+        fmt_init(&f, buf, sizeof buf);
+        fmt_uint(&f, thisChannel->members.size);
+        fmt_end(&f);
+
+        messageArgs[0] = thisChannel->name;
+        /*messageArgs[2] = thisChannel->topic;*/ /*not required by this project */
+        sendNumericReply(client,gen->servername,RPL_LIST,messageArgs,2);
+    }
+    return FALSE;
+}
+
 void cmd_list(CMD_ARGS)
 {
-    client_t *sender = CLIENT_GET(clientList,srcIndex);
-    char buf[32]; /* arbitrary number. I will only hold '# of users' in text */
     char *messageArgs[MAX_MSG_TOKENS];
-    int i;
+    replygen_t *gen;
 
     /* RPL_LISTSTART */
     messageArgs[0] = "Channel";
     messageArgs[1] = "Users Name";
     sendNumericReply(sender,servername,RPL_LISTSTART,messageArgs,2);
 
-    /* RPL_LIST */
-    messageArgs[1] = buf; /* second argument will always be present in buf */
-    for (i = 0; i < arraylist_size(channelList); i++){
-        channel_t *thisChannel = CHANNEL_GET(channelList,i);
-        sprintf(buf,"%d",arraylist_size(thisChannel->userlist) );
-
-        messageArgs[0] = thisChannel->name;
-        /* messageArgs[1] = buf; */
-        /*messageArgs[2] = thisChannel->topic;*/ /*not required by this project */
-
-        sendNumericReply(sender,servername,RPL_LIST,messageArgs,2);
+    /* RPL_LIST ... RPL_LISTEND, produced as the client reads them */
+    if (!(gen = replygen_create(list_step, servername, NULL, 0))){
+        messageArgs[0] = "End of /LIST";
+        sendNumericReply(sender,servername,RPL_LISTEND,messageArgs,1);
+        return;
     }
-
-    /* RPL_LISTEND */
-    messageArgs[0] = "End of /LIST";
-    sendNumericReply(sender,servername,RPL_LISTEND,messageArgs,1);
+    CURSOR_OPEN(&gen->cursor, channelList);
+    gen->walking = TRUE;
+    replygen_start(sender, gen);
 }
 
 void cmd_privmsg(CMD_ARGS)
 {
-    client_t *sender = CLIENT_GET(clientList, srcIndex);
-    int i,j;
+    int i;
     char *messageArgs[MAX_MSG_TOKENS];
     int numTarget;
     char **targets = splitByDelimStr(params[0],",",&numTarget,NULL);
@@ -515,21 +602,20 @@ void cmd_privmsg(CMD_ARGS)
     /* Iterate through targets */
     for (i = 0; i < numTarget; i++){
         /* search users */
-        int userIndex = findClientIndexByNick(clientList,targets[i]);
-        if (userIndex >= 0){
+        client_t *receiver = findClientByNick(targets[i]);
+        if (receiver){
             /* user found */
-            client_t *receiver = CLIENT_GET(clientList,userIndex);
             sendPRIVMSG(receiver,sender,targets[i],message);
             continue;
         }
         /* search channel */
-        int channelIndex = findChannelIndexByChanname(channelList, targets[i]);
-        if (channelIndex >= 0){
-            channel_t *theChannel = CHANNEL_GET(channelList,channelIndex);
-            for (j=0; j < arraylist_size(theChannel->userlist); j++){
-                client_t *receiver = CLIENT_GET(theChannel->userlist, j);
-                sendPRIVMSG(receiver,sender,targets[i],message);
-            }
+        channel_t *theChannel = findChannelByName(targets[i]);
+        if (theChannel){
+            char buf[MAX_CONTENT_LENGTH+1];
+
+            /* format once, every member shares it */
+            formatPRIVMSG(buf,sizeof buf,sender,targets[i],message);
+            sendChannelBroadcast(sender,theChannel,TRUE,buf);
             continue;
         }
         /* if not found send ERR_NOSUCHNICK */
@@ -541,46 +627,249 @@ void cmd_privmsg(CMD_ARGS)
 
     freeTokens(&targets, numTarget);
 }
-void cmd_who(CMD_ARGS)
-{
-    int i, j;
-    client_t *sender = CLIENT_GET(clientList,srcIndex);
+static void send_end_of_who(client_t *client, char *servername, char *mask){
     char *messageArgs[MAX_MSG_TOKENS];
 
-    int channelIndex;
+    messageArgs[0] = mask;
+    messageArgs[1] = "End of/WHO list";
+    sendNumericReply(client,servername,RPL_ENDOFWHO,messageArgs,2);
+}
+
+/* stamps the members of every channel of client, client included, with a new epoch */
+static unsigned mark_co_members(client_t *client){
+    unsigned epoch = beginVisit();
+    membership_t *m;
+    int i;
+
+    for (m = client->channels; m; m = m->next){
+        membervec_t *members = &m->channel->members;
+
+        for (i = 0; i < members->size; i++)
+            members->data[i].client->visitEpoch = epoch;
+    }
+    return epoch;
+}
+
+/* bare WHO: every client not sharing a channel with the requester */
+static Boolean who_all_step(client_t *client, replygen_t *gen){
+    client_t *otherClient;
+
+    /* stamps are redone if another pass used the epochs since the last step, or
+       somebody (the requester included) joined or left a channel in between */
+    if (gen->epoch == 0 || gen->epoch != visitEpoch || gen->stampedAt != membershipChanges){
+        gen->epoch = mark_co_members(client);
+        gen->stampedAt = membershipChanges;
+    }
+
+    while (replygen_room(client)){
+        if (!(otherClient = cursor_next(&gen->cursor))){
+            send_end_of_who(client,gen->servername,"*");
+            return TRUE;
+        }
+        if (otherClient->visitEpoch != gen->epoch){
+            sendWHOREPLY(client,otherClient,NULL,gen->servername);
+        }
+    }
+    return FALSE;
+}
+
+/* matches mask against nick, user, host, server and real name of client */
+static Boolean who_matches(const mask_t *mask, client_t *client){
+    client_info_t *info = client->info;
+
+    return mask_match(mask, client->nick) ||
+           mask_match(mask, info->user) ||
+           mask_match(mask, info->hostname) ||
+           mask_match(mask, info->servername) ||
+           (info->realname && mask_match(mask, info->realname));
+}
+
+/* WHO name,...: members of each channel, the clients matching each mask,
+   or the client of each nick */
+static Boolean who_names_step(client_t *client, replygen_t *gen){
     channel_t *theChannel;
     client_t *otherClient;
+    char *name;
+
+    while (replygen_room(client)){
+        if (gen->inChannel){
+            /* in the middle of a channel. it ends early if the channel goes away */
+            if ((otherClient = cursor_next(&gen->members))){
+                sendWHOREPLY(client,otherClient,gen->args[gen->argIndex],gen->servername);
+                continue;
+            }
+            cursor_close(&gen->members);
+            gen->inChannel = FALSE;
+            send_end_of_who(client,gen->servername,gen->args[gen->argIndex++]);
+            continue;
+        }
+        if (gen->walking){
+            /* in the middle of matching a mask against clientList */
+            if ((otherClient = cursor_next(&gen->cursor))){
+                if (who_matches(gen->mask,otherClient))
+                    sendWHOREPLY(client,otherClient,NULL,gen->servername);
+                continue;
+            }
+            cursor_close(&gen->cursor);
+            gen->walking = FALSE;
+            mask_free(gen->mask);
+            gen->mask = NULL;
+            send_end_of_who(client,gen->servername,gen->args[gen->argIndex++]);
+            continue;
+        }
+        if (gen->argIndex == gen->numArgs)
+            return TRUE;
+
+        name = gen->args[gen->argIndex];
+        if ((theChannel = findChannelByName(name))){
+            CURSOR_OPEN(&gen->members, &theChannel->members);
+            gen->inChannel = TRUE;
+            continue;
+        }
+        if (mask_has_wildcards(name) && (gen->mask = mask_compile(name))){
+            CURSOR_OPEN(&gen->cursor, gen->clients);
+            gen->walking = TRUE;
+            continue;
+        }
+        if ((otherClient = findClientByNick(name)) != NULL){
+            sendWHOREPLY(client,otherClient,NULL,gen->servername);
+        }
+        send_end_of_who(client,gen->servername,name);
+        gen->argIndex++;
+    }
+    return FALSE;
+}
+
+void cmd_who(CMD_ARGS)
+{
+    replygen_t *gen;
 
     /* if no args given */
     if (n_params == 0){
-        for (i = 0; i < arraylist_size(clientList); i++){
-            client_t *otherClient = CLIENT_GET(clientList,i);
-            if (!arraylist_has_intersection(sender->chanlist,otherClient->chanlist)){
-                sendWHOREPLY(sender,otherClient,NULL,servername);
-            }
+        if (!(gen = replygen_create(who_all_step, servername, NULL, 0))){
+            send_end_of_who(sender,servername,"*");
+            return;
         }
-        messageArgs[0] = "*";
-        messageArgs[1] = "End of/WHO list";
-        sendNumericReply(sender,servername,RPL_ENDOFWHO,messageArgs,2);
-        return;
+        CURSOR_OPEN(&gen->cursor, clientList);
+        gen->walking = TRUE;
     }
     else{
-        int numName;
+        int numName = 0;
         char **names = splitByDelimStr(params[0],",",&numName, NULL);
-        for (i = 0; i < numName; i++){
-            channelIndex = findChannelIndexByChanname(channelList,names[i]);
-            if (channelIndex >= 0){
-                theChannel = CHANNEL_GET(channelList,channelIndex);
-                for (j = 0; j < arraylist_size(theChannel->userlist); j++){
-                    otherClient = CLIENT_GET(theChannel->userlist,j);
-                    sendWHOREPLY(sender,otherClient,names[i],servername);
-                }
+
+        /* out of memory: the request still gets its end */
+        if (!names || !(gen = replygen_create(who_names_step, servername, names, numName))){
+            send_end_of_who(sender,servername,params[0]);
+            return;
+        }
+        gen->clients = clientList;
+    }
+    replygen_start(sender, gen);
+}
+
+
+/* NAMES #chan,...: each channel's members, packed into as few lines as fit */
+static Boolean names_given_step(client_t *client, replygen_t *gen){
+    channel_t *theChannel;
+    client_t *member;
+    char *name;
+
+    while (replygen_room(client)){
+        if (gen->inChannel){
+            /* ends early if the channel goes away */
+            if ((member = cursor_next(&gen->members))){
+                namesAdd(client, &gen->names, member->nick);
+                continue;
             }
-            messageArgs[0] = names[i];
-            messageArgs[1] = "End of/WHO list";
-            sendNumericReply(sender,servername,RPL_ENDOFWHO,messageArgs,2);
+            cursor_close(&gen->members);
+            gen->inChannel = FALSE;
+            namesFlush(client, &gen->names);
+            send_end_of_names(client, gen->servername, gen->args[gen->argIndex++]);
+            continue;
         }
+        if (gen->argIndex == gen->numArgs)
+            return TRUE;
+
+        name = gen->args[gen->argIndex];
+        if ((theChannel = findChannelByName(name))){
+            namesBegin(&gen->names, gen->servername, theChannel->name);
+            CURSOR_OPEN(&gen->members, &theChannel->members);
+            gen->inChannel = TRUE;
+            continue;
+        }
+        /* unknown channels just get their end */
+        send_end_of_names(client, gen->servername, name);
+        gen->argIndex++;
     }
+    return FALSE;
+}
 
+/* phases of a bare NAMES */
+#define NAMES_CHANNELS 0    /* every channel */
+#define NAMES_LONERS 1      /* then the clients on no channel, under "*" */
+
+static Boolean names_all_step(client_t *client, replygen_t *gen){
+    channel_t *theChannel;
+    client_t *member;
+
+    while (replygen_room(client)){
+        if (gen->inChannel){
+            if ((member = cursor_next(&gen->members))){
+                namesAdd(client, &gen->names, member->nick);
+                continue;
+            }
+            cursor_close(&gen->members);
+            gen->inChannel = FALSE;
+            namesFlush(client, &gen->names);
+            continue;
+        }
+        if (gen->phase == NAMES_CHANNELS){
+            if ((theChannel = cursor_next(&gen->cursor))){
+                namesBegin(&gen->names, gen->servername, theChannel->name);
+                CURSOR_OPEN(&gen->members, &theChannel->members);
+                gen->inChannel = TRUE;
+                continue;
+            }
+            cursor_close(&gen->cursor);
+            CURSOR_OPEN(&gen->cursor, gen->clients);
+            gen->phase = NAMES_LONERS;
+            namesBegin(&gen->names, gen->servername, "*");
+            continue;
+        }
+        if ((member = cursor_next(&gen->cursor))){
+            if (!member->channels && member->registered)
+                namesAdd(client, &gen->names, member->nick);
+            continue;
+        }
+        namesFlush(client, &gen->names);
+        send_end_of_names(client, gen->servername, "*");
+        return TRUE;
+    }
+    return FALSE;
 }
 
+void cmd_names(CMD_ARGS)
+{
+    replygen_t *gen;
+
+    if (n_params == 0){
+        if (!(gen = replygen_create(names_all_step, servername, NULL, 0))){
+            send_end_of_names(sender, servername, "*");
+            return;
+        }
+        gen->clients = clientList;
+        CURSOR_OPEN(&gen->cursor, channelList);
+        gen->walking = TRUE;
+    }
+    else{
+        int numName = 0;
+        char **names = splitByDelimStr(params[0],",",&numName, NULL);
+
+        /* out of memory: the request still gets its end */
+        if (!names || !(gen = replygen_create(names_given_step, servername, names, numName))){
+            send_end_of_names(sender, servername, params[0]);
+            return;
+        }
+    }
+    replygen_start(sender, gen);
+}
@@ -2,9 +2,22 @@
 #define _IRC_PROTO_H_
 
 
-#include "arraylist.h"
+#include "scan.h"
+#include "common.h"
 
-void handle_line(Arraylist clientList, int srcIndex, Arraylist channelList, char *servername, char *line);
+/* a line split into prefix, command and parameters, pointing into the line */
+typedef struct {
+    char *prefix;       /* NULL if none */
+    char *command;      /* NULL if the line holds none */
+    const struct cmd_hash_entry *cmd; /* dispatch entry of command, NULL if unknown */
+    char *params[MAX_MSG_TOKENS];
+    int n_params;
+} parsed_line_t;
+
+/* parse_scanned_line: splits the line (in place) and looks its command up. Touches no shared state */
+void parse_scanned_line(scanned_line_t *scanned, parsed_line_t *parsed);
+/* dispatch_line: checks and runs the command of parsed for sender */
+void dispatch_line(clientvec_t *clientList, client_t *sender, chanvec_t *channelList, char *servername, parsed_line_t *parsed);
 
 
 
@@ -0,0 +1,144 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/eventfd.h>
+#include "mailbox.h"
+#include "debug.h"
+
+#define RECORD_ALIGN 8
+
+int mailbox_init(mailbox_t *box){
+    unsigned long i;
+
+    box->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (box->efd < 0){
+        DEBUG_PERROR("eventfd");
+        return -1;
+    }
+    atomic_init(&box->tail, 0);
+    atomic_init(&box->signalled, 0);
+    box->head = 0;
+    for (i = 0; i < MAILBOX_SLOTS; i++){
+        atomic_init(&box->slots[i].seq, i);
+        box->slots[i].mail = NULL;
+    }
+    return 0;
+}
+
+int mailbox_post(mailbox_t *box, mail_t *mail){
+    unsigned long pos = atomic_load_explicit(&box->tail, memory_order_relaxed);
+    mail_slot_t *slot;
+    uint64_t one = 1;
+
+    for (;;){
+        unsigned long seq;
+        long diff;
+
+        slot = &box->slots[pos & (MAILBOX_SLOTS - 1)];
+        seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        diff = (long)(seq - pos);
+        if (diff == 0){
+            /* free for this lap. pos is reloaded if another producer got it first */
+            if (atomic_compare_exchange_weak_explicit(&box->tail, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed))
+                break;
+        }
+        else if (diff < 0){
+            return -1; /* the consumer has not taken this slot of the previous lap */
+        }
+        else{
+            pos = atomic_load_explicit(&box->tail, memory_order_relaxed);
+        }
+    }
+    slot->mail = mail;
+    atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+
+    /* pairs with the fence of mailbox_ack: either the consumer sees this mail
+       after clearing signalled, or we see it cleared and wake it up */
+    atomic_thread_fence(memory_order_seq_cst);
+    if (!atomic_load_explicit(&box->signalled, memory_order_relaxed)
+        && !atomic_exchange_explicit(&box->signalled, 1, memory_order_relaxed)){
+        while (write(box->efd, &one, sizeof(one)) < 0 && errno == EINTR)
+            ;
+    }
+    return 0;
+}
+
+void mailbox_ack(mailbox_t *box){
+    uint64_t count;
+
+    atomic_store_explicit(&box->signalled, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    while (read(box->efd, &count, sizeof(count)) < 0 && errno == EINTR)
+        ;
+}
+
+int mailbox_take(mailbox_t *box, mail_t **mails, int max){
+    int n;
+
+    for (n = 0; n < max; n++){
+        mail_slot_t *slot = &box->slots[box->head & (MAILBOX_SLOTS - 1)];
+
+        /* a slot claimed but not published yet ends the batch. its
+           producer's post wakes us again */
+        if (atomic_load_explicit(&slot->seq, memory_order_acquire) != box->head + 1)
+            break;
+        mails[n] = slot->mail;
+        atomic_store_explicit(&slot->seq, box->head + MAILBOX_SLOTS, memory_order_release);
+        box->head++;
+    }
+    return n;
+}
+
+void mail_free(mail_t *mail){
+    free(mail);
+}
+
+record_t *outbox_record(outbox_t *ob, unsigned type, unsigned size, int fd, unsigned long serial){
+    record_t *rec;
+
+    size = (size + RECORD_ALIGN - 1) & ~(RECORD_ALIGN - 1);
+    if (ob->mail && ob->mail->cap - ob->mail->len < size)
+        outbox_ship(ob);
+    if (!ob->mail){
+        unsigned cap = size > MAIL_SIZE ? size : MAIL_SIZE;
+
+        if (!(ob->mail = malloc(sizeof(mail_t) + cap))){
+            DPRINTF(DEBUG_ERRS,"outbox_record: out of memory\n");
+            return NULL;
+        }
+        ob->mail->len = 0;
+        ob->mail->cap = cap;
+    }
+    rec = (record_t *)(ob->mail->data + ob->mail->len);
+    ob->mail->len += size;
+    rec->type = type;
+    rec->size = size;
+    rec->fd = fd;
+    rec->serial = serial;
+    return rec;
+}
+
+int outbox_ship(outbox_t *ob){
+    if (ob->mail){
+        /* behind whatever a full dest refused before */
+        ob->mail->next = NULL;
+        if (ob->overflow)
+            ob->overflowTail->next = ob->mail;
+        else
+            ob->overflow = ob->mail;
+        ob->overflowTail = ob->mail;
+        ob->numOverflow++;
+        ob->mail = NULL;
+    }
+    while (ob->overflow){
+        mail_t *next = ob->overflow->next; /* the consumer may free it once posted */
+
+        if (mailbox_post(ob->dest, ob->overflow) < 0)
+            return -1;
+        ob->overflow = next;
+        ob->numOverflow--;
+    }
+    return 0;
+}
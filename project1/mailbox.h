@@ -0,0 +1,115 @@
+#ifndef _MAILBOX_H_
+#define _MAILBOX_H_
+
+#include <stdatomic.h>
+
+/** MAILBOX_H
+ *
+ *  Message passing between the I/O workers and the core (see worker.h).
+ *
+ *  A mail is a batch of records, filled by one thread during one round of
+ *  its loop and handed over as a whole: a thread keeps an outbox per
+ *  destination and ships it when the round ends or the mail is full, so a
+ *  fan-out to a thousand clients of one worker costs one mail.
+ *
+ *  A mailbox is a bounded lock-free multi-producer, single-consumer ring of
+ *  MAILBOX_SLOTS mails. Producers claim a slot by advancing the shared tail
+ *  and publish it through the slot's sequence number; the consumer takes
+ *  published slots in a batch, in order, without any atomic read-modify-write.
+ *  The producers' index, the wakeup flag and the consumer's index sit on
+ *  cache lines of their own.
+ *
+ *  The consumer sleeps on an eventfd. Wakeups are coalesced: only the first
+ *  post after the consumer went back to taking writes to it, so a burst of
+ *  mails costs one wakeup. Mails of one producer arrive in the order they
+ *  were posted.
+ *
+ *  A full mailbox refuses a post. The outbox keeps refused mails, in order,
+ *  and retries on the next ship. How many it keeps is up to its owner:
+ *  outbox_full() tells when maxOverflow is reached.
+ **/
+
+#define MAIL_SIZE (16 * 1024)   /* room of a mail, unless one record needs more */
+#ifndef MAILBOX_SLOTS
+#define MAILBOX_SLOTS 1024      /* power of two. stalltest.rb builds with 2 */
+#endif
+#define CACHE_LINE 64
+
+/* header of every record. records are 8-byte aligned */
+typedef struct {
+    unsigned short type;
+    unsigned short size;    /* of the whole record, header included */
+    int fd;                 /* connection the record is about */
+    unsigned long serial;   /* which connection on that fd */
+} record_t;
+
+typedef struct mail_s {
+    struct mail_s *next;    /* outbox overflow */
+    unsigned len;           /* bytes of records in data */
+    unsigned cap;
+    _Alignas(8) char data[];
+} mail_t;
+
+typedef struct {
+    atomic_ulong seq;       /* == position + 1 once published, position + MAILBOX_SLOTS once taken */
+    mail_t *mail;
+} mail_slot_t;
+
+/* must be CACHE_LINE aligned: static, or from aligned_alloc() */
+typedef struct {
+    _Alignas(CACHE_LINE) atomic_ulong tail; /* next position to claim. producers */
+    _Alignas(CACHE_LINE) atomic_int signalled; /* eventfd written since the consumer last looked */
+    int efd;
+    _Alignas(CACHE_LINE) unsigned long head; /* next position to take. consumer */
+    _Alignas(CACHE_LINE) mail_slot_t slots[MAILBOX_SLOTS];
+} mailbox_t;
+
+/* mailbox_init: empty mailbox. -1 on error */
+int mailbox_init(mailbox_t *box);
+/* mailbox_fd: descriptor the consumer waits on for EV_READ */
+static inline int mailbox_fd(const mailbox_t *box){
+    return box->efd;
+}
+
+/* mailbox_post: hands mail over to the consumer of box. any thread. -1 if box is full */
+int mailbox_post(mailbox_t *box, mail_t *mail);
+/* mailbox_ack: consumer woke up. to be called before taking the mails */
+void mailbox_ack(mailbox_t *box);
+/* mailbox_take: up to max oldest mails into mails. returns number taken.
+ *               The consumer frees them with mail_free */
+int mailbox_take(mailbox_t *box, mail_t **mails, int max);
+void mail_free(mail_t *mail);
+
+/* records of a mail, in order */
+static inline record_t *mail_first(mail_t *mail){
+    return mail->len ? (record_t *)mail->data : (record_t *)0;
+}
+static inline record_t *mail_next(mail_t *mail, record_t *rec){
+    char *next = (char *)rec + rec->size;
+    return next < mail->data + mail->len ? (record_t *)next : (record_t *)0;
+}
+
+/* mail being filled for one destination */
+typedef struct {
+    mail_t *mail;
+    mailbox_t *dest;
+    mail_t *overflow, *overflowTail; /* refused by a full dest, oldest first */
+    unsigned numOverflow;
+    unsigned maxOverflow;   /* for outbox_full. 0: no limit */
+} outbox_t;
+
+/* outbox_record: room for a record of size bytes (header included) at the end of ob's mail,
+ *                header filled in. NULL if out of memory */
+record_t *outbox_record(outbox_t *ob, unsigned type, unsigned size, int fd, unsigned long serial);
+/* outbox_ship: posts what ob holds. -1 if dest was full: the rest waits in ob */
+int outbox_ship(outbox_t *ob);
+/* outbox_pending: mails wait for room in dest */
+static inline int outbox_pending(const outbox_t *ob){
+    return ob->overflow != (mail_t *)0;
+}
+/* outbox_full: maxOverflow mails wait already. The owner should stop making more */
+static inline int outbox_full(const outbox_t *ob){
+    return ob->maxOverflow && ob->numOverflow >= ob->maxOverflow;
+}
+
+#endif /* _MAILBOX_H_ */
@@ -0,0 +1,110 @@
+#include <stdlib.h>
+#include <string.h>
+#include "match.h"
+#include "hashtab.h"
+#include "debug.h"
+
+/* run of mask characters between two '*'s */
+typedef struct {
+    unsigned off, len; /* in text */
+} piece_t;
+
+struct mask_s {
+    int star;           /* mask has a '*': pieces may float */
+    int leadingStar, trailingStar;
+    int numPieces;
+    unsigned minLen;    /* characters a name needs at least */
+    char *text;         /* folded pieces, back to back */
+    piece_t pieces[];
+};
+
+int mask_has_wildcards(const char *s){
+    return strpbrk(s, "*?") != NULL;
+}
+
+mask_t *mask_compile(const char *mask){
+    size_t len = strlen(mask);
+    size_t maxPieces = len / 2 + 1; /* pieces are at least one character apart */
+    mask_t *m;
+    const char *p;
+    unsigned n = 0;
+
+    m = malloc(sizeof(mask_t) + maxPieces * sizeof(piece_t) + len + 1);
+    if (!m){
+        DPRINTF(DEBUG_ERRS,"mask_compile: out of memory\n");
+        return NULL;
+    }
+    m->text = (char *)&m->pieces[maxPieces];
+    m->star = strchr(mask, '*') != NULL;
+    m->leadingStar = mask[0] == '*';
+    m->trailingStar = len > 0 && mask[len - 1] == '*';
+    m->numPieces = 0;
+
+    for (p = mask; *p; ){
+        piece_t *piece;
+
+        if (*p == '*'){
+            p++;
+            continue;
+        }
+        piece = &m->pieces[m->numPieces++];
+        piece->off = n;
+        while (*p && *p != '*')
+            m->text[n++] = irc_tolower(*p++);
+        piece->len = n - piece->off;
+    }
+    m->text[n] = '\0';
+    m->minLen = n;
+    return m;
+}
+
+void mask_free(mask_t *mask){
+    free(mask);
+}
+
+static int piece_at(const mask_t *m, const piece_t *piece, const char *s){
+    const unsigned char *t = (const unsigned char *)m->text + piece->off;
+    unsigned i;
+
+    for (i = 0; i < piece->len; i++){
+        if (t[i] != '?' && t[i] != irc_tolower(s[i]))
+            return 0;
+    }
+    return 1;
+}
+
+int mask_match(const mask_t *m, const char *name){
+    size_t len = strlen(name);
+    size_t pos = 0, end = len;
+    int first = 0, last = m->numPieces;
+
+    if (len < m->minLen)
+        return 0;
+    if (!m->star)
+        return len == m->minLen && (m->numPieces == 0 || piece_at(m, &m->pieces[0], name));
+
+    /* the first piece sits at the start, the last at the end */
+    if (!m->leadingStar){
+        if (!piece_at(m, &m->pieces[0], name))
+            return 0;
+        pos = m->pieces[first++].len;
+    }
+    if (!m->trailingStar && last > first){
+        const piece_t *piece = &m->pieces[--last];
+
+        end = len - piece->len;
+        if (end < pos || !piece_at(m, piece, name + end))
+            return 0;
+    }
+    /* the rest in order, each as far left as it goes */
+    for (; first < last; first++){
+        const piece_t *piece = &m->pieces[first];
+
+        while (pos + piece->len <= end && !piece_at(m, piece, name + pos))
+            pos++;
+        if (pos + piece->len > end)
+            return 0;
+        pos += piece->len;
+    }
+    return 1;
+}
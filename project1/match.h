@@ -0,0 +1,28 @@
+#ifndef _MATCH_H_
+#define _MATCH_H_
+
+/** MATCH_H
+ *
+ *  IRC masks ("*.edu", "n?ck*") compiled once and matched against many
+ *  names, as WHO does against every client.
+ *
+ *  '*' matches any run of characters, '?' any one character. Case follows
+ *  the RFC 1459 mapping. Compiling folds the mask and splits it at the '*'s
+ *  into literal pieces; matching anchors the first and last piece and
+ *  finds the ones in between left to right, without backtracking.
+ **/
+
+typedef struct mask_s mask_t;
+
+/* mask_compile: compiled form of mask. NULL if out of memory */
+mask_t *mask_compile(const char *mask);
+/* mask_free: NULL is ignored */
+void mask_free(mask_t *mask);
+
+/* mask_match: TRUE if name matches mask */
+int mask_match(const mask_t *mask, const char *name);
+
+/* mask_has_wildcards: TRUE if s contains '*' or '?' */
+int mask_has_wildcards(const char *s);
+
+#endif /* _MATCH_H_ */
@@ -1,71 +1,101 @@
 #include "message.h"
 #include "common.h"
 #include "debug.h"
-#include "arraylist.h"
+#include "fmt.h"
+#include "worker.h"
 #include <string.h>
 #include <ctype.h>
 
-/* prepareMessage: adds deep copy of null terminated message + "\r\n" onto receiver's out queue */
+/* prepareMessage: copies null terminated message + "\r\n" onto receiver's out queue */
 int prepareMessage(client_t *receiver, char *message){
-  char *toSend = malloc (sizeof(char) * (MAX_MSG_LEN + 1) );
+  return prepareMessageLen(receiver, message, strlen(message));
+}
 
-  if (!toSend){
-    DPRINTF(DEBUG_ERRS,"Failed to create copy of the message to client %d\n",receiver->sock);
-    return -1;
-  }
+/* prepareMessageLen: copies len bytes of message + "\r\n" onto receiver's out queue */
+int prepareMessageLen(client_t *receiver, const char *message, size_t len){
   /* size to copy */
-  size_t len = min(MAX_MSG_LEN-2,strlen(message));
-  memcpy(toSend,message,len);
-  /*decorate ending myself. snprintf might just truncate necessary ending*/
-  toSend[len] = '\r';
-  toSend[len+1] = '\n';
-  toSend[len+2] = '\0';
-
-  DPRINTF(DEBUG_COMMANDS, "Ready to send message: %sEOM\n",toSend);
-  if (arraylist_add(receiver->outbuf,toSend) < 0){
+  len = min(MAX_MSG_LEN-2,len);
+
+  DPRINTF(DEBUG_COMMANDS, "Ready to send message: %.*s\r\nEOM\n",(int)len,message);
+  /* the worker of receiver queues it, with the ending decorated on the way */
+  if (worker_post_bytes(receiver,message,len) < 0){
     DPRINTF(DEBUG_ERRS,"Failed to add a message onto outbuf of client %d\n",receiver->sock);
     return -1;
   }
+  return 0;
+}
+
+/* preparePayload: formats null terminated message + "\r\n" once, for queueing on many receivers */
+payload_t *preparePayload(char *message){
+  size_t len = min(MAX_MSG_LEN-2,strlen(message));
+  payload_t *payload = payload_alloc(len+2);
+
+  if (!payload){
+    DPRINTF(DEBUG_ERRS,"Failed to create shared message\n");
+    return NULL;
+  }
+  memcpy(payload->data,message,len);
+  payload->data[len] = '\r';
+  payload->data[len+1] = '\n';
+  DPRINTF(DEBUG_COMMANDS, "Ready to send shared message: %.*sEOM\n",(int)payload->len,payload->data);
+  return payload;
+}
 
+/* prepareSharedMessage: queues a reference to payload onto receiver's out queue */
+int prepareSharedMessage(client_t *receiver, payload_t *payload){
+  if (worker_post_payload(receiver,payload) < 0){
+    DPRINTF(DEBUG_ERRS,"Failed to add a shared message onto outbuf of client %d\n",receiver->sock);
+    return -1;
+  }
   return 0;
 }
+/* ":servername " of the last server seen. Every numeric starts with it.
+   servername strings live as long as the server and never change */
+static char serverPrefix[MAX_SERVERNAME + 3];
+static unsigned serverPrefixLen;
+static const char *serverPrefixOf = NULL;
+
+static void fmtServerPrefix(fmt_t *f, const char *servername){
+  if (servername != serverPrefixOf){
+    fmt_t p;
+
+    fmt_init(&p, serverPrefix, sizeof serverPrefix);
+    fmt_char(&p, ':');
+    fmt_str(&p, servername);
+    fmt_char(&p, ' ');
+    serverPrefixLen = p.len;
+    serverPrefixOf = servername;
+  }
+  fmt_mem(f, serverPrefix, serverPrefixLen);
+}
+
 /* sendNumericReply: creates message with numeric reply code and add it onto receiver's out queue */
 int sendNumericReply(client_t *receiver, char *servername, int replyCode, char **texts, int n_texts){
   char buf[MAX_CONTENT_LENGTH + 1]; /* large enough to hold message */
+  fmt_t f;
   int i;
-  int numWritten;
 
-  numWritten = snprintf(buf,sizeof buf, ":%s %d", servername, replyCode);
-  if (numWritten == sizeof buf){
+  fmt_init(&f, buf, sizeof buf);
+  fmtServerPrefix(&f, servername);
+  fmt_uint(&f, replyCode);
+  if (fmt_cut(&f)){
     DPRINTF(DEBUG_COMMANDS, "sendNumericReply: Message Too Long and we couldn't trucate necessary part\n");
     return -1; /* not enough to fit even necessary part. This won't happen unless servername is humongously long */
   }
 
-  for (i = 0; i < n_texts - 1; i++){
-    numWritten += snprintf(buf + numWritten, sizeof buf  - numWritten, " %s", texts[i]);
-
-    if ( numWritten == sizeof buf){
-      DPRINTF(DEBUG_ERRS, "sendNumericReply: Message Too Long. Truncating message %d for client %d\n", replyCode, receiver->sock);
-      /* just send it. This is okey since errorcode should have been in the queue already. */
-      buf[sizeof buf - 1] = '\0';
-      return prepareMessage(receiver,buf);
-    }
-  }
-
-  if (strchr(texts[n_texts-1],' ')){
-    numWritten += snprintf(buf + numWritten, sizeof buf - numWritten, " :%s", texts[i]);
-  }
-  else{
-    numWritten += snprintf(buf + numWritten, sizeof buf - numWritten, " %s", texts[i]);
+  for (i = 0; i < n_texts; i++){
+    fmt_char(&f, ' ');
+    /* the last argument may hold spaces */
+    if (i == n_texts - 1 && strchr(texts[i],' '))
+      fmt_char(&f, ':');
+    fmt_str(&f, texts[i]);
   }
-  if ( numWritten == sizeof buf ){
-    DPRINTF(DEBUG_ERRS, "sendNumericReply: Message Too Long. Truncating message %d for client %d\n", replyCode, receiver->sock);
+  if (fmt_cut(&f)){
     /* just send it. This is okey since errorcode should have been in the queue already. */
-    buf[sizeof buf - 1] = '\0';
-    return prepareMessage(receiver,buf);
+    DPRINTF(DEBUG_ERRS, "sendNumericReply: Message Too Long. Truncating message %d for client %d\n", replyCode, receiver->sock);
   }
-  DPRINTF(DEBUG_COMMANDS,"sendNumericReply: ready to send message '%s' to client %d\n", buf, receiver->sock);
-  return prepareMessage(receiver,buf);
+  DPRINTF(DEBUG_COMMANDS,"sendNumericReply: ready to send message '%s' to client %d\n", fmt_end(&f), receiver->sock);
+  return prepareMessageLen(receiver,buf,f.len);
 }
 
 
@@ -131,58 +161,150 @@ Boolean isValidChanname(char *channame){
 }
 
 int sendChannelBroadcast(client_t *sender, channel_t *channel, Boolean senderreceive, char *message){
+  /* formatted once. each worker with members queues a reference on its slice */
+  payload_t *payload = preparePayload(message);
+
+  if (!payload)
+    return -1;
+  worker_post_channel(channel, senderreceive ? NULL : sender, payload);
+  payload_release(payload);
+  return 0;
+}
+
+/* sendToPeers: the union of sender's channels is walked with a visit epoch,
+   so a client on several of them is stamped on the first and skipped after */
+int sendToPeers(client_t *sender, Boolean senderreceive, char *message){
+  membership_t *m;
+  unsigned epoch;
   int i;
-  for (i = 0; i < arraylist_size(channel->userlist); i++){
-    if (senderreceive || (arraylist_get(channel->userlist,i) != sender) ){
-      prepareMessage(arraylist_get(channel->userlist,i), message); /* ignore return value */
+  payload_t *payload = preparePayload(message);
+
+  if (!payload)
+    return -1;
+  epoch = beginVisit();
+  markVisited(sender, epoch);
+  if (senderreceive)
+    prepareSharedMessage(sender, payload);
+  for (m = sender->channels; m; m = m->next){
+    membervec_t *members = &m->channel->members;
+
+    for (i = 0; i < members->size; i++){
+      if (markVisited(members->data[i].client, epoch))
+        prepareSharedMessage(members->data[i].client, payload); /* ignore return value */
     }
   }
+  payload_release(payload);
   return 0;
 }
 
-void sendNICK(client_t *receiver, client_t *sender, char *oldNick, char *newNick){
-    char buf[MAX_CONTENT_LENGTH+1];
+/* formatNICK: ":nick!user@host NICK newNick" into buf. returns its length */
+unsigned formatNICK(char *buf, unsigned size, client_t *sender, char *newNick){
+    /* still the old nick: the prefix is rebuilt only once the nick is changed */
+    const prefix_t *prefix = clientPrefix(sender);
+    fmt_t f;
 
-    snprintf(buf,MAX_CONTENT_LENGTH,":%s!%s@%s NICK %s",oldNick,sender->user,sender->hostname,newNick);
-    buf[MAX_CONTENT_LENGTH] = '\0';
-    prepareMessage(receiver,buf);
+    fmt_init(&f, buf, size);
+    fmt_mem(&f, prefix->text, prefix->len);
+    fmt_mem(&f, " NICK ", 6);
+    fmt_str(&f, newNick);
+    fmt_end(&f);
+    return f.len;
 }
-void sendQUIT(client_t *receiver, client_t *sender, char *message){
-    char buf[MAX_CONTENT_LENGTH+1];
+/* formatQUIT: ":nick!user@host QUIT :message" into buf. returns its length */
+unsigned formatQUIT(char *buf, unsigned size, client_t *sender, char *message){
+    const prefix_t *prefix = clientPrefix(sender);
+    fmt_t f;
 
-    snprintf(buf,MAX_CONTENT_LENGTH,":%s!%s@%s QUIT :%s",sender->nick,sender->user,sender->hostname,message);
-    buf[MAX_CONTENT_LENGTH] = '\0';
-    prepareMessage(receiver,buf);
+    fmt_init(&f, buf, size);
+    fmt_mem(&f, prefix->text, prefix->len);
+    fmt_mem(&f, " QUIT :", 7);
+    fmt_str(&f, message);
+    fmt_end(&f);
+    return f.len;
 }
 void sendPRIVMSG(client_t *receiver, client_t *sender, char *target, char *message){
     char buf[MAX_CONTENT_LENGTH+1];
 
-    snprintf(buf,MAX_CONTENT_LENGTH,":%s PRIVMSG %s :%s",sender->nick, target, message);
-    buf[MAX_CONTENT_LENGTH] = '\0';
-    prepareMessage(receiver,buf);
+    prepareMessageLen(receiver,buf,formatPRIVMSG(buf,sizeof buf,sender,target,message));
+}
+/* formatPRIVMSG: ":nick PRIVMSG target :message" into buf. returns its length */
+unsigned formatPRIVMSG(char *buf, unsigned size, client_t *sender, char *target, char *message){
+    const prefix_t *prefix = clientPrefix(sender);
+    fmt_t f;
+
+    fmt_init(&f, buf, size);
+    fmt_mem(&f, prefix->text, prefix->nickLen);
+    fmt_mem(&f, " PRIVMSG ", 9);
+    fmt_str(&f, target);
+    fmt_mem(&f, " :", 2);
+    fmt_str(&f, message);
+    fmt_end(&f);
+    return f.len;
 }
 void sendWHOREPLY(client_t *receiver, client_t *otherClient, char *channel, char *servername){
     char *messageArgs[MAX_MSG_TOKENS];
     char buf[MAX_CONTENT_LENGTH+1];
+    fmt_t f;
+
     if (!channel){
-        messageArgs[0] = (arraylist_size(otherClient->chanlist) == 0)
+        messageArgs[0] = (otherClient->channels == NULL)
                             ? "*"
-                            : CHANNEL_GET(otherClient->chanlist,0)->name;
+                            : otherClient->channels->channel->name;
     }
     else{
         messageArgs[0] = channel;
     }
-    messageArgs[1] = otherClient->user;
-    messageArgs[2] = otherClient->hostname;
-    messageArgs[3] = otherClient->servername;
+    messageArgs[1] = otherClient->info->user;
+    messageArgs[2] = (char *)otherClient->info->hostname;
+    messageArgs[3] = (char *)otherClient->info->servername;
     messageArgs[4] = otherClient->nick;
     messageArgs[5] = "H";
 
-    snprintf(buf,MAX_CONTENT_LENGTH,"%d %s",otherClient->hopcount,otherClient->realname);
-    buf[MAX_CONTENT_LENGTH] = '\0';
-    messageArgs[6] = buf;
+    fmt_init(&f, buf, sizeof buf);
+    fmt_uint(&f, otherClient->info->hopcount);
+    fmt_char(&f, ' ');
+    if (otherClient->info->realname)
+        fmt_str(&f, otherClient->info->realname);
+    messageArgs[6] = fmt_end(&f);
 
     sendNumericReply(receiver,servername, RPL_WHOREPLY, messageArgs,7);
 }
 
 
+
+void namesBegin(namespack_t *pack, char *servername, const char *channame){
+    unsigned overhead;
+
+    pack->servername = servername;
+    strncpy(pack->channame, channame, MAX_CHANNAME);
+    pack->channame[MAX_CHANNAME] = '\0';
+    /* ":" servername " 353 " channame " :" */
+    overhead = 1 + strlen(servername) + 5 + strlen(pack->channame) + 2;
+    pack->room = overhead < MAX_CONTENT_LENGTH ? MAX_CONTENT_LENGTH - overhead : 0;
+    pack->len = 0;
+}
+
+void namesAdd(client_t *receiver, namespack_t *pack, const char *nick){
+    unsigned n = strlen(nick);
+
+    if (pack->len > 0 && pack->len + 1 + n > pack->room)
+        namesFlush(receiver, pack);
+    if (pack->len > 0)
+        pack->nicks[pack->len++] = ' ';
+    if (n > MAX_CONTENT_LENGTH - pack->len)
+        n = MAX_CONTENT_LENGTH - pack->len; /* only with an absurd servername */
+    memcpy(pack->nicks + pack->len, nick, n);
+    pack->len += n;
+}
+
+void namesFlush(client_t *receiver, namespack_t *pack){
+    char *messageArgs[2];
+
+    if (pack->len == 0)
+        return;
+    pack->nicks[pack->len] = '\0';
+    messageArgs[0] = pack->channame;
+    messageArgs[1] = pack->nicks;
+    sendNumericReply(receiver, pack->servername, RPL_NAMREPLY, messageArgs, 2);
+    pack->len = 0;
+}
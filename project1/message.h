@@ -11,8 +11,14 @@
 
  #define MAX_CONTENT_LENGTH (MAX_MSG_LEN-2)  /*size of messsage without CRLF */
 
- /* prepareMessage: adds deep copy of null terminated buf + "\r\n" onto receiver's out queue */
+ /* prepareMessage: copies null terminated buf + "\r\n" onto receiver's out queue */
 int prepareMessage(client_t *receiver, char *message);
+/* prepareMessageLen: same, for a message of known length */
+int prepareMessageLen(client_t *receiver, const char *message, size_t len);
+/* preparePayload: formats buf + "\r\n" once into a shared payload (one reference held by the caller) */
+payload_t *preparePayload(char *message);
+/* prepareSharedMessage: adds a reference to payload onto receiver's out queue */
+int prepareSharedMessage(client_t *receiver, payload_t *payload);
 /* sendNumericReply: creates message with numeric reply code and add it onto receiver's out queue */
 int sendNumericReply(client_t *receiver, char *servername, int replyCode, char **texts, int n_texts);
 /* sendMOTD: send RPL_MOTDSTART, RPL_MOTD, RPL_MOTDEND */
@@ -25,17 +31,40 @@ Boolean isValidChanname(char *channame);
 /* sendChannelBroadcast: send message to Channel.
  *                       sendereceive parameter specifies whether sender should receive the message too */
 int sendChannelBroadcast(client_t *sender, channel_t *channame, Boolean senderreceive, char *message);
+/* sendToPeers: send message once to every client sharing at least one channel with sender,
+ *              however many channels they share. for changes to sender itself (NICK, QUIT) */
+int sendToPeers(client_t *sender, Boolean senderreceive, char *message);
 
-
-void sendNICK(client_t *receiver, client_t *sender, char *oldNick, char *newNick);
-void sendQUIT(client_t *receiver, client_t *sender, char *message);
+/* formatNICK: NICK change line of sender, to be made before its nick changes. returns its length */
+unsigned formatNICK(char *buf, unsigned size, client_t *sender, char *newNick);
+/* formatQUIT: QUIT line of sender. returns its length */
+unsigned formatQUIT(char *buf, unsigned size, client_t *sender, char *message);
 void sendPRIVMSG(client_t *receiver, client_t *sender, char *target, char *message);
+/* formatPRIVMSG: ":nick PRIVMSG target :message" into buf of size bytes. returns its length */
+unsigned formatPRIVMSG(char *buf, unsigned size, client_t *sender, char *target, char *message);
 void sendWHOREPLY(client_t *receiver, client_t *otherClient, char *channel, char *servername);
 
+/* RPL_NAMREPLY lines under construction: nicks are packed greedily, each line
+ * going out once the next nick would not fit in MAX_MSG_LEN */
+typedef struct {
+    char *servername;
+    char channame[MAX_CHANNAME+1];
+    unsigned room;  /* nick bytes that fit after ":server 353 channame :" */
+    unsigned len;
+    char nicks[MAX_CONTENT_LENGTH+1];
+} namespack_t;
+
+/* namesBegin: starts the RPL_NAMREPLY lines of channame ("*" for clients on no channel) */
+void namesBegin(namespack_t *pack, char *servername, const char *channame);
+/* namesAdd: adds nick, sending the line before it to receiver if it is full */
+void namesAdd(client_t *receiver, namespack_t *pack, const char *nick);
+/* namesFlush: sends what is left of the last line */
+void namesFlush(client_t *receiver, namespack_t *pack);
+
 
 
-int sendMessage(Arraylist clientList, client_t *sender, char *destination, char *message);
-int sendUser(Arraylist clientList, client_t *sender, char *channame, char *message);
+int sendMessage(clientvec_t *clientList, client_t *sender, char *destination, char *message);
+int sendUser(clientvec_t *clientList, client_t *sender, char *channame, char *message);
 
 
 
@@ -0,0 +1,201 @@
+/** mpscbench
+ *
+ *  Contention benchmark of the mailbox ring (mailbox.h).
+ *
+ *  P producer threads post N mails each into one mailbox as fast as they
+ *  can; one consumer sleeps on the eventfd, takes mails in batches and
+ *  checks that every producer's mails arrive complete and in order.
+ *  With -m the same runs through a mutex-guarded list instead, for
+ *  comparison. Reports mails per second, consumer wakeups (to see the
+ *  coalescing at work) and how often producers found the ring full.
+ *
+ *  make mpscbench && ./mpscbench [-p producers] [-n mails] [-b batch] [-m]
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sched.h>
+#include <time.h>
+#include <pthread.h>
+#include "mailbox.h"
+
+typedef struct {
+    mail_t mail;
+    unsigned long producer, seq;
+} bench_mail_t;
+
+/* the baseline: one lock around a list, same coalesced wakeup */
+typedef struct {
+    pthread_mutex_t lock;
+    mail_t *head, *tail;
+    int signalled;
+    int efd;
+} locked_box_t;
+
+static mailbox_t box;
+static locked_box_t lbox;
+static int useLock = 0;
+static int numProducers = 4;
+static unsigned long perProducer = 1000000;
+static int batch = 64;
+static atomic_ulong fullRetries;
+static pthread_barrier_t start;
+
+static int post(mail_t *mail){
+    if (!useLock)
+        return mailbox_post(&box, mail);
+
+    uint64_t one = 1;
+    int wake;
+
+    mail->next = NULL;
+    pthread_mutex_lock(&lbox.lock);
+    if (lbox.tail)
+        lbox.tail->next = mail;
+    else
+        lbox.head = mail;
+    lbox.tail = mail;
+    wake = !lbox.signalled;
+    lbox.signalled = 1;
+    pthread_mutex_unlock(&lbox.lock);
+    if (wake)
+        while (write(lbox.efd, &one, sizeof(one)) < 0 && errno == EINTR)
+            ;
+    return 0;
+}
+
+static void ack(void){
+    uint64_t count;
+
+    if (!useLock){
+        mailbox_ack(&box);
+        return;
+    }
+    pthread_mutex_lock(&lbox.lock);
+    lbox.signalled = 0;
+    pthread_mutex_unlock(&lbox.lock);
+    while (read(lbox.efd, &count, sizeof(count)) < 0 && errno == EINTR)
+        ;
+}
+
+static int take(mail_t **mails, int max){
+    int n = 0;
+
+    if (!useLock)
+        return mailbox_take(&box, mails, max);
+    pthread_mutex_lock(&lbox.lock);
+    while (n < max && lbox.head){
+        mails[n++] = lbox.head;
+        lbox.head = lbox.head->next;
+    }
+    if (!lbox.head)
+        lbox.tail = NULL;
+    pthread_mutex_unlock(&lbox.lock);
+    return n;
+}
+
+static void *producer(void *arg){
+    unsigned long id = (unsigned long)arg;
+    bench_mail_t *mails = calloc(perProducer, sizeof(bench_mail_t));
+    unsigned long i, retries = 0;
+
+    if (!mails){
+        perror("calloc");
+        exit(1);
+    }
+    pthread_barrier_wait(&start);
+    for (i = 0; i < perProducer; i++){
+        mails[i].producer = id;
+        mails[i].seq = i;
+        while (post(&mails[i].mail) < 0){
+            retries++;
+            sched_yield();
+        }
+    }
+    atomic_fetch_add(&fullRetries, retries);
+    return NULL; /* mails stay allocated: the consumer may still read them */
+}
+
+static double now(void){
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[]){
+    unsigned long *expected, received = 0, total, wakeups = 0, batches = 0;
+    pthread_t *threads;
+    mail_t **mails;
+    double t0, dt;
+    int ch, i;
+
+    while ((ch = getopt(argc, argv, "p:n:b:m")) != -1){
+        switch (ch){
+        case 'p': numProducers = atoi(optarg); break;
+        case 'n': perProducer = strtoul(optarg, NULL, 10); break;
+        case 'b': batch = atoi(optarg); break;
+        case 'm': useLock = 1; break;
+        default:
+            fprintf(stderr, "mpscbench [-p producers] [-n mails] [-b batch] [-m]\n");
+            return 1;
+        }
+    }
+    if (numProducers <= 0 || batch <= 0 || perProducer == 0)
+        return 1;
+
+    if (mailbox_init(&box) < 0)
+        return 1;
+    pthread_mutex_init(&lbox.lock, NULL);
+    lbox.efd = mailbox_fd(&box); /* only one of the two is used */
+
+    expected = calloc(numProducers, sizeof(unsigned long));
+    threads = calloc(numProducers, sizeof(pthread_t));
+    mails = calloc(batch, sizeof(mail_t *));
+    pthread_barrier_init(&start, NULL, numProducers + 1);
+    for (i = 0; i < numProducers; i++)
+        pthread_create(&threads[i], NULL, producer, (void *)(unsigned long)i);
+
+    total = perProducer * numProducers;
+    pthread_barrier_wait(&start);
+    t0 = now();
+    while (received < total){
+        struct pollfd pfd = { mailbox_fd(&box), POLLIN, 0 };
+        int n;
+
+        if (poll(&pfd, 1, -1) < 0 && errno != EINTR){
+            perror("poll");
+            return 1;
+        }
+        wakeups++;
+        ack();
+        while ((n = take(mails, batch)) > 0){
+            batches++;
+            for (i = 0; i < n; i++){
+                bench_mail_t *m = (bench_mail_t *)mails[i];
+
+                if (m->seq != expected[m->producer]){
+                    fprintf(stderr, "producer %lu: got %lu, expected %lu\n",
+                            m->producer, m->seq, expected[m->producer]);
+                    return 1;
+                }
+                expected[m->producer]++;
+            }
+            received += n;
+        }
+    }
+    dt = now() - t0;
+    for (i = 0; i < numProducers; i++)
+        pthread_join(threads[i], NULL);
+
+    printf("%s: %d producers x %lu mails in %.3f s, %.2f M mails/s\n",
+           useLock ? "mutex list" : "mpsc ring", numProducers, perProducer, dt, total / dt / 1e6);
+    printf("  %lu wakeups (%.1f mails each), %.1f mails per batch, %lu full retries\n",
+           wakeups, (double)total / wakeups, (double)total / batches, (unsigned long)atomic_load(&fullRetries));
+    return 0;
+}
@@ -0,0 +1,214 @@
+#include <stdlib.h>
+#include <string.h>
+#include "outq.h"
+#include "pool.h"
+#include "debug.h"
+
+/*
+  constants
+*/
+#define OUTQ_REFS_INITIAL_CAPACITY 16 /* power of two */
+#define PAYLOAD_CLASSES 4
+
+/* payload size classes, header included. The largest holds a full IRC line;
+   anything bigger comes from malloc */
+static pool_t payloadPools[PAYLOAD_CLASSES] = {
+    POOL_INITIALIZER("payload64", 64),
+    POOL_INITIALIZER("payload128", 128),
+    POOL_INITIALIZER("payload256", 256),
+    POOL_INITIALIZER("payload576", 576),
+};
+
+static pool_t *payload_pool(unsigned len){
+    size_t size = sizeof(payload_t) + len;
+    int i;
+
+    for (i = 0; i < PAYLOAD_CLASSES; i++){
+        if (size <= payloadPools[i].objsize)
+            return &payloadPools[i];
+    }
+    return NULL;
+}
+
+payload_t *payload_alloc(unsigned len){
+    pool_t *pool = payload_pool(len);
+    payload_t *payload = pool ? pool_alloc(pool) : malloc(sizeof(payload_t) + len);
+
+    if (!payload){
+        DPRINTF(DEBUG_ERRS,"payload_alloc: failed to allocate %u bytes\n",len);
+        return NULL;
+    }
+    atomic_init(&payload->refcount, 1);
+    payload->len = len;
+    return payload;
+}
+
+void payload_retain(payload_t *payload){
+    atomic_fetch_add_explicit(&payload->refcount, 1, memory_order_relaxed);
+}
+
+void payload_release(payload_t *payload){
+    pool_t *pool;
+
+    if (atomic_fetch_sub_explicit(&payload->refcount, 1, memory_order_acq_rel) == 1){
+        if ((pool = payload_pool(payload->len)))
+            pool_free(pool, payload);
+        else
+            free(payload);
+    }
+}
+
+void outq_init(outq_t *q){
+    ringbuf_init(&q->bytes);
+    q->refs = NULL;
+    q->ref_head = 0;
+    q->ref_count = 0;
+    q->ref_capacity = 0;
+    q->ref_offset = 0;
+    q->tail_gap = 0;
+    q->size = 0;
+}
+
+void outq_free(outq_t *q){
+    unsigned i;
+
+    for (i = 0; i < q->ref_count; i++)
+        payload_release(q->refs[(q->ref_head + i) & (q->ref_capacity - 1)].payload);
+    free(q->refs);
+    ringbuf_free(&q->bytes);
+    outq_init(q);
+}
+
+int outq_reserve(outq_t *q, unsigned len){
+    return ringbuf_reserve(&q->bytes, len);
+}
+
+int outq_write(outq_t *q, const void *src, unsigned len){
+    if (ringbuf_write(&q->bytes, src, len) < 0)
+        return -1;
+    q->tail_gap += len;
+    q->size += len;
+    return 0;
+}
+
+static int outq_grow_refs(outq_t *q){
+    unsigned newCapacity = q->ref_capacity ? q->ref_capacity << 1 : OUTQ_REFS_INITIAL_CAPACITY;
+    outref_t *newRefs = malloc(sizeof(outref_t) * newCapacity);
+    unsigned i;
+
+    if (!newRefs){
+        DPRINTF(DEBUG_ERRS,"outq_grow_refs: failed to grow to %u entries\n",newCapacity);
+        return -1;
+    }
+    for (i = 0; i < q->ref_count; i++)
+        newRefs[i] = q->refs[(q->ref_head + i) & (q->ref_capacity - 1)];
+    free(q->refs);
+    q->refs = newRefs;
+    q->ref_capacity = newCapacity;
+    q->ref_head = 0;
+    return 0;
+}
+
+int outq_push_ref(outq_t *q, payload_t *payload){
+    outref_t *ref;
+
+    if (q->ref_count == q->ref_capacity && outq_grow_refs(q) < 0)
+        return -1;
+    ref = &q->refs[(q->ref_head + q->ref_count) & (q->ref_capacity - 1)];
+    ref->payload = payload;
+    ref->gap = q->tail_gap;
+    q->ref_count++;
+    q->tail_gap = 0;
+    q->size += payload->len;
+    payload_retain(payload);
+    return 0;
+}
+
+/* describe len ring bytes starting skip bytes into the ring. returns entries used */
+static int outq_ring_slice(const struct iovec *ring, int numRing, unsigned skip, unsigned len,
+                           struct iovec *iov, int maxiov){
+    int i, n = 0;
+
+    for (i = 0; i < numRing && len > 0 && n < maxiov; i++){
+        unsigned segLen = ring[i].iov_len;
+        unsigned take;
+
+        if (skip >= segLen){
+            skip -= segLen;
+            continue;
+        }
+        take = segLen - skip;
+        if (take > len)
+            take = len;
+        iov[n].iov_base = (char *)ring[i].iov_base + skip;
+        iov[n].iov_len = take;
+        n++;
+        len -= take;
+        skip = 0;
+    }
+    return n;
+}
+
+int outq_peek(const outq_t *q, struct iovec *iov, int maxiov){
+    struct iovec ring[2];
+    int numRing = ringbuf_peek(&q->bytes, ring);
+    unsigned ringSkip = 0;
+    unsigned i;
+    int n = 0;
+
+    for (i = 0; i < q->ref_count && n < maxiov; i++){
+        const outref_t *ref = &q->refs[(q->ref_head + i) & (q->ref_capacity - 1)];
+        unsigned offset = (i == 0) ? q->ref_offset : 0;
+
+        n += outq_ring_slice(ring, numRing, ringSkip, ref->gap, iov + n, maxiov - n);
+        ringSkip += ref->gap;
+        if (n == maxiov)
+            return n;
+        iov[n].iov_base = ref->payload->data + offset;
+        iov[n].iov_len = ref->payload->len - offset;
+        n++;
+    }
+    if (i == q->ref_count)
+        n += outq_ring_slice(ring, numRing, ringSkip, q->tail_gap, iov + n, maxiov - n);
+    return n;
+}
+
+void outq_consume(outq_t *q, unsigned n){
+    if (n > q->size)
+        n = q->size;
+    q->size -= n;
+
+    while (n > 0 && q->ref_count > 0){
+        outref_t *ref = &q->refs[q->ref_head];
+        unsigned left;
+
+        if (ref->gap > 0){
+            unsigned take = (n < ref->gap) ? n : ref->gap;
+            ringbuf_consume(&q->bytes, take);
+            ref->gap -= take;
+            n -= take;
+            continue;
+        }
+        left = ref->payload->len - q->ref_offset;
+        if (n < left){
+            q->ref_offset += n;
+            return;
+        }
+        n -= left;
+        payload_release(ref->payload);
+        q->ref_offset = 0;
+        q->ref_head = (q->ref_head + 1) & (q->ref_capacity - 1);
+        q->ref_count--;
+    }
+    if (q->ref_count == 0 && q->refs){
+        /* idle again: give the reference FIFO back */
+        free(q->refs);
+        q->refs = NULL;
+        q->ref_capacity = 0;
+        q->ref_head = 0;
+    }
+    if (n > 0){
+        ringbuf_consume(&q->bytes, n);
+        q->tail_gap -= n;
+    }
+}
@@ -0,0 +1,70 @@
+#ifndef _OUTQ_H_
+#define _OUTQ_H_
+
+#include <sys/uio.h>
+#include <stdatomic.h>
+#include "ringbuf.h"
+
+/** OUTQ_H
+ *
+ *  Output queue of a client: unicast bytes copied into a ringbuf_t, interleaved
+ *  with references to shared, immutable payloads.
+ *
+ *  A payload is formatted once (e.g. one channel line) and queued by reference on
+ *  every receiver. Each reference remembers how many ring bytes were queued
+ *  before it (its gap), so the original order is kept without copying.
+ *  The payload is released when the last receiver has sent it. Payloads are
+ *  made by the core and sent by the I/O workers, so references are counted
+ *  atomically.
+ **/
+
+typedef struct {
+    atomic_int refcount;
+    unsigned len;
+    char data[]; /* len bytes, not NUL terminated */
+} payload_t;
+
+/* payload_alloc: new payload of len (unfilled) bytes, holding one reference for the creator */
+payload_t *payload_alloc(unsigned len);
+void payload_retain(payload_t *payload);
+void payload_release(payload_t *payload);
+
+typedef struct {
+    payload_t *payload;
+    unsigned gap; /* ring bytes to send before this payload */
+} outref_t;
+
+typedef struct {
+    ringbuf_t bytes;
+    outref_t *refs;        /* FIFO of queued payload references. NULL while empty */
+    unsigned ref_head;
+    unsigned ref_count;
+    unsigned ref_capacity; /* power of two */
+    unsigned ref_offset;   /* bytes of the first payload already sent */
+    unsigned tail_gap;     /* ring bytes queued after the last reference */
+    unsigned size;         /* total bytes still to send */
+} outq_t;
+
+void outq_init(outq_t *q);
+void outq_free(outq_t *q);
+
+static inline unsigned outq_size(const outq_t *q){
+    return q->size;
+}
+static inline int outq_is_empty(const outq_t *q){
+    return q->size == 0;
+}
+
+/* outq_reserve: makes sure len more unicast bytes can be written without failing. -1 if out of memory */
+int outq_reserve(outq_t *q, unsigned len);
+/* outq_write: appends len unicast bytes. -1 if out of memory */
+int outq_write(outq_t *q, const void *src, unsigned len);
+/* outq_push_ref: appends a reference to payload (retained). -1 if out of memory */
+int outq_push_ref(outq_t *q, payload_t *payload);
+
+/* outq_peek: describes the head of the queue in at most maxiov entries. returns number used */
+int outq_peek(const outq_t *q, struct iovec *iov, int maxiov);
+/* outq_consume: drops n sent bytes from the front, releasing finished payloads */
+void outq_consume(outq_t *q, unsigned n);
+
+#endif /* _OUTQ_H_ */
@@ -0,0 +1,166 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <assert.h>
+#include "pool.h"
+#include "debug.h"
+
+#define POOL_ALIGN 16
+
+struct pool_slab_s {
+    pool_slab_t *prev, *next;   /* pool->partial */
+    void *freelist;             /* freed objects, linked through their first word */
+    char *fresh;                /* next never-used object */
+    unsigned numFree;           /* freelist + never-used objects */
+};
+
+#define SLAB_HEADER_SIZE ((sizeof(pool_slab_t) + POOL_ALIGN - 1) & ~(size_t)(POOL_ALIGN - 1))
+#define SLAB_OF(OBJ) ((pool_slab_t *)((uintptr_t)(OBJ) & ~(uintptr_t)(POOL_SLAB_SIZE - 1)))
+
+static pool_t *_Atomic allPools = NULL;
+static int releaseEmpty = 0;
+static __thread char threadTag; /* its address tells threads apart */
+
+void pool_set_release(int enable){
+    releaseEmpty = enable;
+}
+
+static void partial_push(pool_t *pool, pool_slab_t *slab){
+    slab->prev = NULL;
+    slab->next = pool->partial;
+    if (pool->partial)
+        pool->partial->prev = slab;
+    pool->partial = slab;
+}
+
+static void partial_unlink(pool_t *pool, pool_slab_t *slab){
+    if (slab->prev)
+        slab->prev->next = slab->next;
+    else
+        pool->partial = slab->next;
+    if (slab->next)
+        slab->next->prev = slab->prev;
+}
+
+/* first use: settle object size and slab geometry, and register for pool_report() */
+static void pool_setup(pool_t *pool){
+    pool->objsize = (pool->objsize + POOL_ALIGN - 1) & ~(size_t)(POOL_ALIGN - 1);
+    if (pool->objsize < sizeof(void *))
+        pool->objsize = sizeof(void *);
+    pool->perSlab = (POOL_SLAB_SIZE - SLAB_HEADER_SIZE) / pool->objsize;
+    pool->owner = &threadTag;
+    pool->nextPool = atomic_load_explicit(&allPools, memory_order_relaxed);
+    while (!atomic_compare_exchange_weak_explicit(&allPools, &pool->nextPool, pool,
+                                                  memory_order_release, memory_order_relaxed))
+        ;
+}
+
+static pool_slab_t *slab_create(pool_t *pool){
+    pool_slab_t *slab;
+
+    if (posix_memalign((void **)&slab, POOL_SLAB_SIZE, POOL_SLAB_SIZE) != 0){
+        DPRINTF(DEBUG_ERRS,"pool_alloc: failed to get a slab for %s\n",pool->name);
+        return NULL;
+    }
+    slab->freelist = NULL;
+    slab->fresh = (char *)slab + SLAB_HEADER_SIZE;
+    slab->numFree = pool->perSlab;
+    pool->slabs++;
+    pool->emptySlabs++;
+    partial_push(pool, slab);
+    return slab;
+}
+
+/* obj goes back on its slab. owner thread only */
+static void pool_put(pool_t *pool, void *obj){
+    pool_slab_t *slab = SLAB_OF(obj);
+
+    *(void **)obj = slab->freelist;
+    slab->freelist = obj;
+    if (slab->numFree++ == 0)
+        partial_push(pool, slab);
+    pool->allocated--;
+
+    if (slab->numFree == pool->perSlab){
+        pool->emptySlabs++;
+        if (releaseEmpty && pool->emptySlabs > 1){
+            partial_unlink(pool, slab);
+            pool->emptySlabs--;
+            pool->slabs--;
+            free(slab);
+        }
+    }
+}
+
+/* puts back what other threads freed since the last time */
+static void pool_collect(pool_t *pool){
+    void *obj = atomic_exchange_explicit(&pool->remoteFree, NULL, memory_order_acquire);
+
+    while (obj){
+        void *next = *(void **)obj;
+
+        pool_put(pool, obj);
+        obj = next;
+    }
+}
+
+void *pool_alloc(pool_t *pool){
+    pool_slab_t *slab;
+    void *obj;
+
+    if (pool->perSlab == 0)
+        pool_setup(pool);
+    assert(pool->owner == &threadTag);
+    if (atomic_load_explicit(&pool->remoteFree, memory_order_relaxed))
+        pool_collect(pool);
+    slab = pool->partial;
+    if (!slab && !(slab = slab_create(pool)))
+        return NULL;
+
+    if (slab->numFree == pool->perSlab)
+        pool->emptySlabs--;
+    if (slab->freelist){
+        obj = slab->freelist;
+        slab->freelist = *(void **)obj;
+    }
+    else{
+        /* objects are handed out in address order the first time, so a
+           new slab is only touched (and paged in) as it fills up */
+        obj = slab->fresh;
+        slab->fresh += pool->objsize;
+    }
+    if (--slab->numFree == 0)
+        partial_unlink(pool, slab);
+
+    if (++pool->allocated > pool->highWater)
+        pool->highWater = pool->allocated;
+    return obj;
+}
+
+void pool_free(pool_t *pool, void *obj){
+    void *head;
+
+    if (!obj)
+        return;
+    if (pool->owner == &threadTag){
+        pool_put(pool, obj);
+        return;
+    }
+    /* not ours: the owner takes the whole list at once, so a plain push is safe */
+    head = atomic_load_explicit(&pool->remoteFree, memory_order_relaxed);
+    do {
+        *(void **)obj = head;
+    } while (!atomic_compare_exchange_weak_explicit(&pool->remoteFree, &head, obj,
+                                                    memory_order_release, memory_order_relaxed));
+}
+
+void pool_report(void){
+    pool_t *pool;
+
+    eprintf("%-12s %8s %10s %10s %10s %8s\n","pool","objsize","allocated","free","highwater","slabs");
+    for (pool = atomic_load_explicit(&allPools, memory_order_acquire); pool; pool = pool->nextPool){
+        eprintf("%-12s %8lu %10lu %10lu %10lu %8lu\n",pool->name,
+                (unsigned long)pool->objsize,(unsigned long)pool->allocated,
+                (unsigned long)pool_free_count(pool),(unsigned long)pool->highWater,
+                (unsigned long)pool->slabs);
+    }
+}
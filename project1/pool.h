@@ -0,0 +1,70 @@
+#ifndef _POOL_H_
+#define _POOL_H_
+
+#include <stddef.h>
+#include <stdatomic.h>
+
+/** POOL_H
+ *
+ *  Slab allocator for fixed-size objects (clients, channels, memberships,
+ *  message payloads).
+ *
+ *  Objects are carved out of POOL_SLAB_SIZE blocks aligned to that size, so
+ *  the slab of any object is found by masking its address. Freed objects go
+ *  on their slab's free list and are reused before a new slab is taken.
+ *  Slabs with room are kept on a list per pool; allocation prefers them over
+ *  fresh ones, which keeps live objects packed and lets churn settle instead
+ *  of fragmenting the heap.
+ *
+ *  Empty slabs are kept for reuse unless pool_set_release(TRUE) was called,
+ *  in which case every empty slab beyond one spare per pool goes back to the OS.
+ *
+ *  A pool belongs to the thread that first allocates from it; only that
+ *  thread may allocate. Other threads may free (a payload released by the
+ *  I/O worker that sent it): such objects are pushed onto a lock-free list
+ *  and put back by the owner on its next allocation. Pools used by several
+ *  threads are declared POOL_THREAD_LOCAL, one per thread.
+ **/
+
+#define POOL_SLAB_SIZE (64 * 1024) /* power of two */
+
+typedef struct pool_slab_s pool_slab_t;
+
+typedef struct pool_s {
+    const char *name;
+    size_t objsize;         /* rounded up to POOL_ALIGN */
+    unsigned perSlab;       /* objects per slab */
+    pool_slab_t *partial;   /* slabs with at least one free object */
+    unsigned emptySlabs;    /* slabs with no object in use */
+    /* counters */
+    size_t allocated;       /* objects in use */
+    size_t highWater;       /* most objects ever in use at once */
+    size_t slabs;           /* slabs held */
+    const void *owner;      /* thread allocating from the pool */
+    void *_Atomic remoteFree; /* objects freed by other threads, linked through their first word */
+    struct pool_s *nextPool; /* all pools, for pool_report() */
+} pool_t;
+
+/* POOL_INITIALIZER: static pool of objects of size bytes */
+#define POOL_INITIALIZER(NAME,SIZE) { (NAME), (SIZE), 0, NULL, 0, 0, 0, 0, NULL, NULL, NULL }
+/* POOL_THREAD_LOCAL: storage class of a pool every thread has its own copy of */
+#define POOL_THREAD_LOCAL static __thread
+
+/* pool_alloc: uninitialized object. NULL if out of memory */
+void *pool_alloc(pool_t *pool);
+/* pool_free: gives obj (from pool_alloc on the same pool) back, from any thread. NULL is ignored */
+void pool_free(pool_t *pool, void *obj);
+
+/* pool_free_count: objects available in slabs already held */
+static inline size_t pool_free_count(const pool_t *pool){
+    return pool->slabs * pool->perSlab - pool->allocated;
+}
+
+/* pool_set_release: whether empty slabs (beyond one spare per pool) are returned to the OS */
+void pool_set_release(int enable);
+
+/* pool_report: prints counters of every pool used so far to stderr. counters of
+ *              other threads' pools are read while they change, so they are approximate */
+void pool_report(void);
+
+#endif /* _POOL_H_ */
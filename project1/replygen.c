@@ -0,0 +1,86 @@
+#include "replygen.h"
+#include "pool.h"
+#include "debug.h"
+
+#include <limits.h>
+
+unsigned long long replygenBudgetEnd = 0;
+static pool_t replygenPool = POOL_INITIALIZER("replygen", sizeof(replygen_t));
+
+replygen_t *replygen_create(replygen_step_fn step, char *servername, char **args, int numArgs){
+    replygen_t *gen = pool_alloc(&replygenPool);
+
+    if (!gen){
+        DPRINTF(DEBUG_ERRS,"replygen_create: out of memory\n");
+        if (args)
+            freeTokens(&args, numArgs);
+        return NULL;
+    }
+    gen->step = step;
+    gen->servername = servername;
+    gen->walking = FALSE;
+    gen->inChannel = FALSE;
+    gen->phase = 0;
+    gen->epoch = 0;
+    gen->stampedAt = 0;
+    gen->mask = NULL;
+    gen->args = args;
+    gen->numArgs = args ? numArgs : 0;
+    gen->argIndex = 0;
+    gen->clients = NULL;
+    gen->next = NULL;
+    return gen;
+}
+
+static void replygen_free(replygen_t *gen){
+    if (gen->walking)
+        cursor_close(&gen->cursor);
+    if (gen->inChannel)
+        cursor_close(&gen->members);
+    mask_free(gen->mask);
+    if (gen->args)
+        freeTokens(&gen->args, gen->numArgs);
+    pool_free(&replygenPool, gen);
+}
+
+void replygen_start(client_t *client, replygen_t *gen){
+    replygen_t **tail = &client->info->replies;
+
+    while (*tail)
+        tail = &(*tail)->next;
+    *tail = gen;
+    client->replying = TRUE;
+    if (client->info->replies == gen)
+        replygen_resume(client);
+}
+
+void replygen_resume(client_t *client){
+    replygen_t *gen;
+
+    /* only this client's lines are posted until we return */
+    replygenBudgetEnd = coreBytesPosted + REPLYGEN_HIGH_WATER;
+    for (;;){
+        while ((gen = client->info->replies) && replygen_room(client)){
+            if (!gen->step(client, gen))
+                break; /* budget spent */
+            client->info->replies = gen->next;
+            replygen_free(gen);
+        }
+        client->replying = client->info->replies != NULL;
+        if (!client->replying || worker_post_notify(client, REPLYGEN_LOW_WATER) == 0)
+            return;
+        /* out of memory: no REC_DRAINED would step the rest. finish it now,
+           so every reply (RPL_LISTEND and the like) still gets its end */
+        replygenBudgetEnd = ULLONG_MAX;
+    }
+}
+
+void replygen_free_all(client_t *client){
+    replygen_t *gen;
+
+    while ((gen = client->info->replies)){
+        client->info->replies = gen->next;
+        replygen_free(gen);
+    }
+    client->replying = FALSE;
+}
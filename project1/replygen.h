@@ -0,0 +1,74 @@
+#ifndef _REPLYGEN_H_
+#define _REPLYGEN_H_
+
+#include "common.h"
+#include "message.h"
+#include "cursor.h"
+#include "match.h"
+#include "worker.h"
+
+/** REPLYGEN_H
+ *
+ *  Long replies (LIST, WHO, NAMES) produced a piece at a time.
+ *
+ *  A command that may answer with many lines attaches a generator to the
+ *  client instead of queueing everything at once. The generator's step
+ *  queues lines until REPLYGEN_HIGH_WATER bytes went to the client's
+ *  worker, which is then asked (REC_NOTIFY) to report when the client's out
+ *  queue has drained below REPLYGEN_LOW_WATER; the answer steps it again.
+ *  A client that does not read costs one step.
+ *
+ *  Generators of a client run one after another, in the order the commands
+ *  came in. Lines of other commands may go out in between.
+ **/
+
+#define REPLYGEN_LOW_WATER  (4 * 1024)
+#define REPLYGEN_HIGH_WATER (16 * 1024)
+
+typedef struct replygen_s replygen_t;
+
+/* replygen_step_fn: queues the next lines of the reply while replygen_room() allows.
+ *                   returns TRUE once the reply is complete */
+typedef Boolean (*replygen_step_fn)(client_t *client, replygen_t *gen);
+
+struct replygen_s {
+    replygen_step_fn step;
+    char *servername;
+    cursor_t cursor;    /* walk of clientList or channelList */
+    Boolean walking;    /* cursor is open */
+    cursor_t members;   /* walk of one channel's members */
+    Boolean inChannel;  /* members is open */
+    int phase;          /* for replies made of several walks */
+    unsigned epoch;     /* visit stamp of the clients to leave out, 0 for none yet */
+    unsigned long stampedAt; /* membershipChanges when they were stamped */
+    mask_t *mask;       /* compiled target being matched by the walk, owned */
+    clientvec_t *clients; /* clientList, for a walk after the channels */
+    namespack_t names;  /* NAMES line being filled */
+    char **args;        /* comma separated targets of the command, owned */
+    int numArgs;
+    int argIndex;       /* next target */
+    replygen_t *next;   /* client's queue of generators */
+};
+
+/* replygen_create: new generator for step. args (from splitByDelimStr) are taken over.
+ *                  NULL if out of memory */
+replygen_t *replygen_create(replygen_step_fn step, char *servername, char **args, int numArgs);
+
+/* replygen_start: queues gen on client, and runs its first step if nothing is ahead */
+void replygen_start(client_t *client, replygen_t *gen);
+
+/* replygen_resume: steps client's generators for up to REPLYGEN_HIGH_WATER bytes, or until none are left */
+void replygen_resume(client_t *client);
+
+/* replygen_free_all: drops client's unfinished replies */
+void replygen_free_all(client_t *client);
+
+/* end of the budget of the step being run, in coreBytesPosted */
+extern unsigned long long replygenBudgetEnd;
+
+/* replygen_room: TRUE while a step may queue more lines */
+static inline Boolean replygen_room(client_t *client){
+    return coreBytesPosted < replygenBudgetEnd;
+}
+
+#endif /* _REPLYGEN_H_ */
@@ -0,0 +1,371 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include "resolver.h"
+#include "hashtab.h"
+#include "intern.h"
+#include "pool.h"
+#include "vec.h"
+#include "debug.h"
+
+typedef struct {
+    int fd;
+    unsigned long serial;
+} waiter_t;
+
+VEC_DEFINE(waitvec, waiter_t, 1)
+
+typedef struct dns_entry_s {
+    char addr[INET6_ADDRSTRLEN];    /* numeric address, the cache key */
+    const char *hostname;           /* interned. NULL if the address has no name */
+    time_t expires;
+    int pending;                    /* lookup in flight; not on the LRU list */
+    waitvec_t waiters;              /* requests answered when the lookup lands */
+    struct dns_entry_s *prev, *next; /* LRU list of settled entries, most recent first */
+} dns_entry_t;
+
+typedef struct dns_job_s {
+    dns_entry_t *entry;
+    struct sockaddr_storage addr;
+    char host[NI_MAXHOST];
+    int found;
+    struct dns_job_s *next;
+} dns_job_t;
+
+typedef struct {
+    dns_job_t *head, *tail;
+} job_queue_t;
+
+/* an address of the stub table (resolver_stub) */
+typedef struct {
+    char addr[INET6_ADDRSTRLEN];
+    char name[NI_MAXHOST];          /* "%d" stands for the lookup count. empty: no name */
+    int delayMs;
+    atomic_int lookups;
+} stub_entry_t;
+
+/* shared with the resolver threads, under queueLock */
+static pthread_mutex_t queueLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t jobReady = PTHREAD_COND_INITIALIZER;
+static job_queue_t todo = {NULL, NULL};
+static job_queue_t finished = {NULL, NULL};
+static resolver_lookup_fn lookupFn;
+static int wakeFds[2] = {-1, -1};
+
+/* read-only once loaded, but for the lookup counts */
+static stub_entry_t *stubTable = NULL;
+static int stubCount = 0;
+
+/* loop thread only */
+static int started = 0;
+static hashtab_t *cache;
+static int cacheCount = 0;
+static int cacheSize = RESOLVER_CACHE_SIZE;
+static int positiveTtl = RESOLVER_POSITIVE_TTL;
+static int negativeTtl = RESOLVER_NEGATIVE_TTL;
+static dns_entry_t *lruHead = NULL, *lruTail = NULL;
+static pool_t entryPool = POOL_INITIALIZER("dns_entry", sizeof(dns_entry_t));
+static pool_t jobPool = POOL_INITIALIZER("dns_job", sizeof(dns_job_t));
+
+static const char *entry_key(const void *item){
+    return ((const dns_entry_t *)item)->addr;
+}
+
+static void queue_push(job_queue_t *q, dns_job_t *job){
+    job->next = NULL;
+    if (q->tail)
+        q->tail->next = job;
+    else
+        q->head = job;
+    q->tail = job;
+}
+
+static int getnameinfo_lookup(const struct sockaddr *addr, socklen_t addrlen, char *host, size_t hostlen){
+    return getnameinfo(addr, addrlen, host, hostlen, NULL, 0, NI_NAMEREQD);
+}
+
+/* answers from stubTable, after the entry's delay. unlisted addresses have no name */
+static int stub_lookup(const struct sockaddr *addr, socklen_t addrlen, char *host, size_t hostlen){
+    char numeric[INET6_ADDRSTRLEN];
+    const char *count;
+    stub_entry_t *entry = NULL;
+    int i, n;
+
+    if (getnameinfo(addr, addrlen, numeric, sizeof(numeric), NULL, 0, NI_NUMERICHOST) != 0)
+        return -1;
+    for (i = 0; i < stubCount && !entry; i++){
+        if (!strcmp(stubTable[i].addr, numeric))
+            entry = &stubTable[i];
+    }
+    if (!entry)
+        return -1;
+    if (entry->delayMs > 0){
+        struct timespec ts = { entry->delayMs / 1000, (entry->delayMs % 1000) * 1000000L };
+        nanosleep(&ts, NULL);
+    }
+    n = atomic_fetch_add(&entry->lookups, 1) + 1;
+    DPRINTF(DEBUG_DNS,"resolver stub: lookup %d of %s\n",n,numeric);
+    if (!entry->name[0])
+        return -1;
+    if ((count = strstr(entry->name, "%d")))
+        snprintf(host, hostlen, "%.*s%d%s", (int)(count - entry->name), entry->name, n, count + 2);
+    else
+        snprintf(host, hostlen, "%s", entry->name);
+    return 0;
+}
+
+resolver_lookup_fn resolver_stub(const char *path){
+    char line[512], addr[INET6_ADDRSTRLEN], name[NI_MAXHOST];
+    stub_entry_t *table;
+    int lineno = 0, delayMs, a, b;
+    FILE *file = fopen(path, "r");
+
+    if (!file){
+        DEBUG_PERROR("resolver_stub");
+        return NULL;
+    }
+    while (fgets(line, sizeof(line), file)){
+        lineno++;
+        if (line[0] == '#' || strspn(line, " \t\r\n") == strlen(line))
+            continue;
+        if (sscanf(line, "ttl %d %d", &a, &b) == 2){
+            positiveTtl = a;
+            negativeTtl = b;
+            continue;
+        }
+        if (sscanf(line, "cache %d", &a) == 1 && a > 0){
+            cacheSize = a;
+            continue;
+        }
+        delayMs = 0;
+        if (sscanf(line, "%45s %1024s %d", addr, name, &delayMs) < 2){
+            fprintf(stderr, "%s:%d: expected <address> <name or -> [delay ms]\n", path, lineno);
+            fclose(file);
+            return NULL;
+        }
+        if (!(table = realloc(stubTable, (stubCount + 1) * sizeof(stub_entry_t)))){
+            fclose(file);
+            return NULL;
+        }
+        stubTable = table;
+        strcpy(stubTable[stubCount].addr, addr);
+        strcpy(stubTable[stubCount].name, strcmp(name, "-") ? name : "");
+        stubTable[stubCount].delayMs = delayMs;
+        atomic_init(&stubTable[stubCount].lookups, 0);
+        stubCount++;
+    }
+    fclose(file);
+    DPRINTF(DEBUG_DNS,"resolver stub: %d addresses, ttl %d/%d, cache %d\n",
+            stubCount,positiveTtl,negativeTtl,cacheSize);
+    return stub_lookup;
+}
+
+static void *resolver_thread(void *arg){
+    dns_job_t *job;
+    socklen_t addrlen;
+    int wake;
+
+    (void)arg;
+    for (;;){
+        pthread_mutex_lock(&queueLock);
+        while (!todo.head)
+            pthread_cond_wait(&jobReady, &queueLock);
+        job = todo.head;
+        todo.head = job->next;
+        if (!todo.head)
+            todo.tail = NULL;
+        pthread_mutex_unlock(&queueLock);
+
+        addrlen = job->addr.ss_family == AF_INET6 ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+        job->found = lookupFn((struct sockaddr *)&job->addr, addrlen, job->host, sizeof(job->host)) == 0;
+
+        /* one wakeup per batch: the loop takes every finished job at once */
+        pthread_mutex_lock(&queueLock);
+        wake = !finished.head;
+        queue_push(&finished, job);
+        pthread_mutex_unlock(&queueLock);
+        if (wake && write(wakeFds[1], "", 1) < 0)
+            DEBUG_PERROR("resolver: wakeup");
+    }
+    return NULL;
+}
+
+int resolver_start(int nthreads, resolver_lookup_fn lookup){
+    pthread_t thread;
+    int i, flags;
+
+    lookupFn = lookup ? lookup : getnameinfo_lookup;
+    cache = hashtab_create_exact(entry_key);
+    if (!cache)
+        return -1;
+    if (pipe(wakeFds) < 0){
+        DEBUG_PERROR("resolver: pipe");
+        return -1;
+    }
+    for (i = 0; i < 2; i++){
+        flags = fcntl(wakeFds[i], F_GETFL);
+        fcntl(wakeFds[i], F_SETFL, flags | O_NONBLOCK);
+        fcntl(wakeFds[i], F_SETFD, FD_CLOEXEC);
+    }
+    for (i = 0; i < nthreads; i++){
+        if (pthread_create(&thread, NULL, resolver_thread, NULL) != 0){
+            DPRINTF(DEBUG_ERRS,"resolver_start: could only start %d of %d threads\n",i,nthreads);
+            break;
+        }
+        pthread_detach(thread);
+    }
+    if (i == 0)
+        return -1;
+    started = 1;
+    return wakeFds[0];
+}
+
+static void lru_unlink(dns_entry_t *entry){
+    if (entry->prev)
+        entry->prev->next = entry->next;
+    else
+        lruHead = entry->next;
+    if (entry->next)
+        entry->next->prev = entry->prev;
+    else
+        lruTail = entry->prev;
+}
+
+static void lru_push_front(dns_entry_t *entry){
+    entry->prev = NULL;
+    entry->next = lruHead;
+    if (lruHead)
+        lruHead->prev = entry;
+    else
+        lruTail = entry;
+    lruHead = entry;
+}
+
+/* drops the least recently used settled entry. 0 if every entry is in flight */
+static int cache_evict(void){
+    dns_entry_t *entry = lruTail;
+
+    if (!entry)
+        return 0;
+    lru_unlink(entry);
+    hashtab_remove(cache, entry);
+    intern_release(entry->hostname);
+    waitvec_free(&entry->waiters);
+    pool_free(&entryPool, entry);
+    cacheCount--;
+    return 1;
+}
+
+/* hands entry's address to the resolver threads */
+static int entry_lookup(dns_entry_t *entry, const struct sockaddr_storage *addr){
+    dns_job_t *job = pool_alloc(&jobPool);
+
+    if (!job)
+        return -1;
+    job->entry = entry;
+    memcpy(&job->addr, addr, sizeof(job->addr));
+    entry->pending = 1;
+    entry->hostname = NULL;
+
+    pthread_mutex_lock(&queueLock);
+    queue_push(&todo, job);
+    pthread_cond_signal(&jobReady);
+    pthread_mutex_unlock(&queueLock);
+    DPRINTF(DEBUG_DNS,"resolver: looking up %s\n",entry->addr);
+    return 0;
+}
+
+resolve_status_t resolver_request(const struct sockaddr_storage *addr, const char *numeric,
+                                  int fd, unsigned long serial, const char **hostname){
+    dns_entry_t *entry;
+    waiter_t waiter;
+
+    if (!started)
+        return RESOLVE_FAILED;
+    entry = hashtab_find(cache, numeric);
+    if (entry && !entry->pending){
+        lru_unlink(entry);
+        if (entry->expires > time(NULL)){
+            lru_push_front(entry);
+            if (!entry->hostname)
+                return RESOLVE_NONAME;
+            *hostname = entry->hostname;
+            return RESOLVE_CACHED;
+        }
+        /* stale: look it up again in place */
+        intern_release(entry->hostname);
+        if (entry_lookup(entry, addr) < 0){
+            hashtab_remove(cache, entry);
+            pool_free(&entryPool, entry);
+            cacheCount--;
+            return RESOLVE_FAILED;
+        }
+    }
+    else if (!entry){
+        if (cacheCount >= cacheSize && !cache_evict())
+            return RESOLVE_FAILED;
+        entry = pool_alloc(&entryPool);
+        if (!entry)
+            return RESOLVE_FAILED;
+        strncpy(entry->addr, numeric, sizeof(entry->addr) - 1);
+        entry->addr[sizeof(entry->addr) - 1] = '\0';
+        waitvec_init(&entry->waiters);
+        if (hashtab_insert(cache, entry) < 0){
+            pool_free(&entryPool, entry);
+            return RESOLVE_FAILED;
+        }
+        cacheCount++;
+        if (entry_lookup(entry, addr) < 0){
+            hashtab_remove(cache, entry);
+            pool_free(&entryPool, entry);
+            cacheCount--;
+            return RESOLVE_FAILED;
+        }
+    }
+
+    /* in flight: answered with everybody else waiting on the same address */
+    waiter.fd = fd;
+    waiter.serial = serial;
+    if (waitvec_push(&entry->waiters, waiter) < 0)
+        return RESOLVE_FAILED;
+    return RESOLVE_QUEUED;
+}
+
+void resolver_complete(resolver_done_fn done){
+    dns_job_t *job, *next;
+    dns_entry_t *entry;
+    char drain[64];
+    time_t now;
+    int i;
+
+    while (read(wakeFds[0], drain, sizeof(drain)) > 0)
+        ;
+    pthread_mutex_lock(&queueLock);
+    job = finished.head;
+    finished.head = finished.tail = NULL;
+    pthread_mutex_unlock(&queueLock);
+
+    now = time(NULL);
+    for (; job; job = next){
+        next = job->next;
+        entry = job->entry;
+        entry->pending = 0;
+        entry->hostname = job->found ? intern_acquire(job->host) : NULL;
+        entry->expires = now + (entry->hostname ? positiveTtl : negativeTtl);
+        lru_push_front(entry);
+        DPRINTF(DEBUG_DNS,"resolver: %s is %s, %d waiting\n",entry->addr,
+                entry->hostname ? entry->hostname : "unnamed",entry->waiters.size);
+
+        for (i = 0; i < entry->waiters.size; i++)
+            done(entry->waiters.data[i].fd, entry->waiters.data[i].serial, entry->hostname);
+        waitvec_free(&entry->waiters);
+        pool_free(&jobPool, job);
+    }
+}
@@ -0,0 +1,62 @@
+#ifndef _RESOLVER_H_
+#define _RESOLVER_H_
+
+#include <sys/types.h>
+#include <sys/socket.h>
+
+/** RESOLVER_H
+ *
+ *  Reverse DNS off the event loop.
+ *
+ *  Lookups run on a small pool of resolver threads. Finished lookups are
+ *  posted back through a wakeup descriptor that the event loop watches; the
+ *  loop then calls resolver_complete(), which runs the completion callback
+ *  on the loop thread, so callers never see a thread.
+ *
+ *  Results are cached by numeric address, least recently used first out,
+ *  with separate lifetimes for names found and for failed lookups.
+ *  Concurrent requests for the same address share one lookup.
+ *
+ *  Everything but the lookup function itself runs on the loop thread.
+ **/
+
+#define RESOLVER_THREADS 4
+#define RESOLVER_CACHE_SIZE 4096   /* addresses remembered, in-flight included */
+#define RESOLVER_POSITIVE_TTL 3600 /* seconds a found name is trusted */
+#define RESOLVER_NEGATIVE_TTL 300  /* seconds before a failed address is retried */
+
+/* resolver_lookup_fn: name of addr into host, 0 on success. Called on resolver threads */
+typedef int (*resolver_lookup_fn)(const struct sockaddr *addr, socklen_t addrlen, char *host, size_t hostlen);
+
+/* resolver_done_fn: result for a request. hostname is NULL if the address has no name.
+ *                   it is interned: acquire it to keep it */
+typedef void (*resolver_done_fn)(int fd, unsigned long serial, const char *hostname);
+
+/* resolver_stub: a lookup answering from the table in path instead of DNS, for testing
+ *                the cache. Lines are "<address> <name> [delay ms]": name "-" has no name,
+ *                a "%d" in it becomes the number of lookups of address so far, so a
+ *                client can tell a cached answer from a new one. Addresses not listed
+ *                have no name. "ttl <positive> <negative>" and "cache <size>" replace
+ *                the lifetimes and the size below. NULL on error. Before resolver_start */
+resolver_lookup_fn resolver_stub(const char *path);
+
+/* resolver_start: starts nthreads resolver threads. lookup NULL uses getnameinfo().
+ *                 returns the descriptor to watch for EV_READ, -1 on error */
+int resolver_start(int nthreads, resolver_lookup_fn lookup);
+
+typedef enum {
+    RESOLVE_QUEUED,   /* done will be called from resolver_complete() */
+    RESOLVE_CACHED,   /* *hostname set from the cache, valid until the next resolver call */
+    RESOLVE_NONAME,   /* cached failure */
+    RESOLVE_FAILED    /* resolver not started, or cache full of lookups in flight */
+} resolve_status_t;
+
+/* resolver_request: looks up the name of addr (numeric form in numeric) on behalf of
+ *                   the connection identified by fd and serial */
+resolve_status_t resolver_request(const struct sockaddr_storage *addr, const char *numeric,
+                                  int fd, unsigned long serial, const char **hostname);
+
+/* resolver_complete: collects finished lookups and calls done for every waiting request */
+void resolver_complete(resolver_done_fn done);
+
+#endif /* _RESOLVER_H_ */
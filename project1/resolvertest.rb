@@ -0,0 +1,113 @@
+#! /usr/local/bin/env ruby
+#
+# Reverse DNS cache test. Runs against a server answering lookups from
+# dnsstub.conf instead of DNS:
+#
+#   ./sircd -R dnsstub.conf 1 node1.conf
+#   ruby resolvertest.rb 20102
+#
+# Clients connect from 127.0.0.1 .. 127.0.0.4 and read their own host back
+# with WHO. The stub names carry the lookup count of the address, so a
+# cached answer (same count), a shared lookup (same count for two clients
+# at once), a stale or evicted entry (next count) and a failed lookup
+# (numeric host) can be told apart.
+
+require 'socket'
+
+$SERVER = "127.0.0.1"
+$PORT = 20102
+
+if ARGV.size >= 1
+    $PORT = Integer(ARGV[0])
+end
+if ARGV.size >= 2
+    $SERVER = ARGV[1].to_s()
+end
+
+class CLIENT
+
+    def initialize(server, port, from, nick)
+        @server = server
+        @port = port
+        @from = from
+        @nick = nick
+    end
+
+    def connect()
+        @sock = TCPSocket.new(@server, @port, @from)
+        @sock.send "NICK #{@nick}\r\nUSER #{@nick} * * :#{@nick}\r\n", 0
+    end
+
+    # host the server has for us, once it stops being numeric or timeout ran out
+    def host(timeout)
+        deadline = Time.now + timeout
+        loop do
+            @sock.send "WHO #{@nick}\r\n", 0
+            h = nil
+            while (line = @sock.gets)
+                f = line.split(" ")
+                h = f[4] if f[1] == "352"
+                break if f[1] == "315"
+            end
+            return h if h != @from || Time.now > deadline
+            sleep 0.1
+        end
+    end
+
+    def disconnect()
+        @sock.close
+    end
+end
+
+$failed = 0
+$serial = 0
+
+# connects from address, returns the host the server settled on
+def host_of(from, timeout = 2)
+    $serial += 1
+    c = CLIENT.new($SERVER, $PORT, from, "dns#{$serial}")
+    c.connect()
+    h = c.host(timeout)
+    c.disconnect()
+    return h
+end
+
+def check(name, got, expected)
+    if got == expected
+        puts "(+) #{name}: #{got}"
+    else
+        puts "(-) #{name}: got #{got}, expected #{expected}"
+        $failed += 1
+    end
+end
+
+check("LOOKUP", host_of("127.0.0.1"), "one-1.stub.test")
+check("CACHED", host_of("127.0.0.1"), "one-1.stub.test")
+
+# 500 ms to answer: both requests wait on the one lookup
+a = CLIENT.new($SERVER, $PORT, "127.0.0.2", "dnsa")
+b = CLIENT.new($SERVER, $PORT, "127.0.0.2", "dnsb")
+a.connect()
+b.connect()
+check("SHARED_LOOKUP", a.host(2), "two-1.stub.test")
+check("SHARED_LOOKUP", b.host(2), "two-1.stub.test")
+a.disconnect()
+b.disconnect()
+
+# past the 6 s lifetime: looked up again
+sleep 7
+check("STALE", host_of("127.0.0.2"), "two-2.stub.test")
+
+# no name: stays numeric. the cache holds 2, so the least recent, 127.0.0.1, goes
+check("NO_NAME", host_of("127.0.0.3", 1), "127.0.0.3")
+check("CACHED", host_of("127.0.0.2"), "two-2.stub.test")
+check("EVICTED", host_of("127.0.0.1"), "one-2.stub.test")
+
+# 127.0.0.2 is used again, so 127.0.0.1 is the least recent and makes room
+check("CACHED", host_of("127.0.0.2"), "two-2.stub.test")
+check("LOOKUP", host_of("127.0.0.4"), "four-1.stub.test")
+check("LRU_KEPT", host_of("127.0.0.2"), "two-2.stub.test")
+check("LRU_EVICTED", host_of("127.0.0.1"), "one-3.stub.test")
+
+puts($failed == 0 ? "\nall passed" : "\n#{$failed} failed")
+exit($failed == 0 ? 0 : 1)
@@ -0,0 +1,142 @@
+#include <stdlib.h>
+#include <string.h>
+#include "ringbuf.h"
+#include "pool.h"
+#include "debug.h"
+
+#define RINGBUF_POOLED_CLASSES 4 /* 2x..16x RINGBUF_INLINE_SIZE */
+
+/* burst buffers come and go with every backlog, so the common sizes are pooled.
+   out queues belong to the I/O worker of their connection: one set per thread */
+POOL_THREAD_LOCAL pool_t ringPools[RINGBUF_POOLED_CLASSES] = {
+    POOL_INITIALIZER("ring1k", RINGBUF_INLINE_SIZE << 1),
+    POOL_INITIALIZER("ring2k", RINGBUF_INLINE_SIZE << 2),
+    POOL_INITIALIZER("ring4k", RINGBUF_INLINE_SIZE << 3),
+    POOL_INITIALIZER("ring8k", RINGBUF_INLINE_SIZE << 4),
+};
+
+static pool_t *ring_pool(unsigned capacity){
+    int i;
+
+    for (i = 0; i < RINGBUF_POOLED_CLASSES; i++){
+        if (capacity == (RINGBUF_INLINE_SIZE << (i + 1)))
+            return &ringPools[i];
+    }
+    return NULL;
+}
+
+static char *ring_block_alloc(unsigned capacity){
+    pool_t *pool = ring_pool(capacity);
+
+    return pool ? pool_alloc(pool) : malloc(capacity);
+}
+
+static void ring_block_free(char *data, unsigned capacity){
+    pool_t *pool = ring_pool(capacity);
+
+    if (pool)
+        pool_free(pool, data);
+    else
+        free(data);
+}
+
+void ringbuf_init(ringbuf_t *rb){
+    rb->data = rb->inline_data;
+    rb->capacity = RINGBUF_INLINE_SIZE;
+    rb->head = 0;
+    rb->size = 0;
+}
+
+void ringbuf_free(ringbuf_t *rb){
+    if (rb->data != rb->inline_data)
+        ring_block_free(rb->data, rb->capacity);
+    ringbuf_init(rb);
+}
+
+/* copy queued bytes in order to dst, which must hold rb->size bytes */
+static void ringbuf_linearize(const ringbuf_t *rb, char *dst){
+    unsigned first = rb->capacity - rb->head;
+
+    if (first >= rb->size){
+        memcpy(dst, rb->data + rb->head, rb->size);
+    }
+    else{
+        memcpy(dst, rb->data + rb->head, first);
+        memcpy(dst + first, rb->data, rb->size - first);
+    }
+}
+
+static int ringbuf_grow(ringbuf_t *rb, unsigned needed){
+    unsigned newCapacity = rb->capacity;
+    char *newData;
+
+    while (newCapacity < needed){
+        if (newCapacity > (~0u >> 1))
+            return -1;
+        newCapacity <<= 1;
+    }
+    newData = ring_block_alloc(newCapacity);
+    if (!newData){
+        DPRINTF(DEBUG_ERRS,"ringbuf_grow: failed to grow to %u bytes\n",newCapacity);
+        return -1;
+    }
+    ringbuf_linearize(rb, newData);
+    if (rb->data != rb->inline_data)
+        ring_block_free(rb->data, rb->capacity);
+    rb->data = newData;
+    rb->capacity = newCapacity;
+    rb->head = 0;
+    return 0;
+}
+
+int ringbuf_reserve(ringbuf_t *rb, unsigned len){
+    if (rb->size + len > rb->capacity)
+        return ringbuf_grow(rb, rb->size + len);
+    return 0;
+}
+
+int ringbuf_write(ringbuf_t *rb, const void *src, unsigned len){
+    unsigned tail, first;
+
+    if (ringbuf_reserve(rb, len) < 0)
+        return -1;
+
+    tail = (rb->head + rb->size) & (rb->capacity - 1);
+    first = rb->capacity - tail;
+    if (first >= len){
+        memcpy(rb->data + tail, src, len);
+    }
+    else{
+        memcpy(rb->data + tail, src, first);
+        memcpy(rb->data, (const char *)src + first, len - first);
+    }
+    rb->size += len;
+    return 0;
+}
+
+int ringbuf_peek(const ringbuf_t *rb, struct iovec *iov){
+    unsigned first;
+
+    if (rb->size == 0)
+        return 0;
+    first = rb->capacity - rb->head;
+    iov[0].iov_base = rb->data + rb->head;
+    if (first >= rb->size){
+        iov[0].iov_len = rb->size;
+        return 1;
+    }
+    iov[0].iov_len = first;
+    iov[1].iov_base = rb->data;
+    iov[1].iov_len = rb->size - first;
+    return 2;
+}
+
+void ringbuf_consume(ringbuf_t *rb, unsigned n){
+    if (n >= rb->size){
+        /* idle again: give the burst buffer back */
+        ringbuf_free(rb);
+        return;
+    }
+    rb->head = (rb->head + n) & (rb->capacity - 1);
+    rb->size -= n;
+}
@@ -0,0 +1,48 @@
+#ifndef _RINGBUF_H_
+#define _RINGBUF_H_
+
+#include <sys/uio.h>
+
+/** RINGBUF_H
+ *
+ *  Byte-oriented output queue of a client.
+ *
+ *  Messages are copied straight into one contiguous circular buffer and drained
+ *  with a single gathered send (at most two segments). Small queues live in the
+ *  inline buffer; bursts grow a heap block geometrically, which is given back
+ *  as soon as the queue drains.
+ **/
+
+#define RINGBUF_INLINE_SIZE 512 /* power of two. enough for one full IRC line */
+
+typedef struct {
+    char *data;         /* inline_data, or heap block while grown */
+    unsigned capacity;  /* power of two */
+    unsigned head;      /* offset of first queued byte */
+    unsigned size;      /* number of queued bytes */
+    char inline_data[RINGBUF_INLINE_SIZE];
+} ringbuf_t;
+
+void ringbuf_init(ringbuf_t *rb);
+void ringbuf_free(ringbuf_t *rb);
+
+static inline unsigned ringbuf_size(const ringbuf_t *rb){
+    return rb->size;
+}
+static inline int ringbuf_is_empty(const ringbuf_t *rb){
+    return rb->size == 0;
+}
+
+/* ringbuf_reserve: makes sure len more bytes can be written without failing. -1 if out of memory */
+int ringbuf_reserve(ringbuf_t *rb, unsigned len);
+
+/* ringbuf_write: appends len bytes of src, growing the buffer if needed. -1 if out of memory */
+int ringbuf_write(ringbuf_t *rb, const void *src, unsigned len);
+
+/* ringbuf_peek: describes queued bytes in iov (room for 2 entries). returns number of entries used */
+int ringbuf_peek(const ringbuf_t *rb, struct iovec *iov);
+
+/* ringbuf_consume: drops n bytes from the front. Falls back to the inline buffer once empty */
+void ringbuf_consume(ringbuf_t *rb, unsigned n);
+
+#endif /* _RINGBUF_H_ */
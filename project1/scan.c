@@ -0,0 +1,150 @@
+#include <string.h>
+#include "scan.h"
+#include "debug.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_HAVE_X86 1
+#endif
+
+static inline int is_delim(char c){
+    return c == '\r' || c == '\n' || c == ' ' || c == ':';
+}
+
+/* base is added to every stored offset */
+static int scan_delims_scalar(const char *buf, unsigned len, unsigned short *pos, unsigned base){
+    unsigned i;
+    int n = 0;
+
+    for (i = 0; i < len; i++){
+        if (is_delim(buf[i]))
+            pos[n++] = base + i;
+    }
+    return n;
+}
+
+#ifdef SCAN_HAVE_X86
+static int scan_delims_sse2(const char *buf, unsigned len, unsigned short *pos, unsigned base){
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i lf = _mm_set1_epi8('\n');
+    const __m128i sp = _mm_set1_epi8(' ');
+    const __m128i colon = _mm_set1_epi8(':');
+    unsigned i = 0;
+    int n = 0;
+
+    for (; i + 16 <= len; i += 16){
+        __m128i v = _mm_loadu_si128((const __m128i *)(buf + i));
+        __m128i m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, cr), _mm_cmpeq_epi8(v, lf)),
+                                 _mm_or_si128(_mm_cmpeq_epi8(v, sp), _mm_cmpeq_epi8(v, colon)));
+        unsigned bits = (unsigned)_mm_movemask_epi8(m);
+
+        while (bits){
+            pos[n++] = base + i + __builtin_ctz(bits);
+            bits &= bits - 1;
+        }
+    }
+    return n + scan_delims_scalar(buf + i, len - i, pos + n, base + i);
+}
+
+__attribute__((target("avx2")))
+static int scan_delims_avx2(const char *buf, unsigned len, unsigned short *pos, unsigned base){
+    const __m256i cr = _mm256_set1_epi8('\r');
+    const __m256i lf = _mm256_set1_epi8('\n');
+    const __m256i sp = _mm256_set1_epi8(' ');
+    const __m256i colon = _mm256_set1_epi8(':');
+    unsigned i = 0;
+    int n = 0;
+
+    for (; i + 32 <= len; i += 32){
+        __m256i v = _mm256_loadu_si256((const __m256i *)(buf + i));
+        __m256i m = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, cr), _mm256_cmpeq_epi8(v, lf)),
+                                    _mm256_or_si256(_mm256_cmpeq_epi8(v, sp), _mm256_cmpeq_epi8(v, colon)));
+        unsigned bits = (unsigned)_mm256_movemask_epi8(m);
+
+        while (bits){
+            pos[n++] = base + i + __builtin_ctz(bits);
+            bits &= bits - 1;
+        }
+    }
+    /* at most 31 bytes left */
+    return n + scan_delims_sse2(buf + i, len - i, pos + n, base + i);
+}
+#endif
+
+/* written by scan_init() before any thread starts, read-only after */
+static int (*scan_impl)(const char *buf, unsigned len, unsigned short *pos, unsigned base) = scan_delims_scalar;
+static const char *scan_name = "scalar";
+
+int scan_delims(const char *buf, unsigned len, unsigned short *pos){
+    return scan_impl(buf, len, pos, 0);
+}
+
+int scan_use(const char *name){
+    if (!strcmp(name, "scalar")){
+        scan_impl = scan_delims_scalar;
+        scan_name = "scalar";
+    }
+#ifdef SCAN_HAVE_X86
+    else if (!strcmp(name, "sse2")){
+        scan_impl = scan_delims_sse2;
+        scan_name = "sse2";
+    }
+    else if (!strcmp(name, "avx2")){
+        __builtin_cpu_init();
+        if (!__builtin_cpu_supports("avx2"))
+            return -1;
+        scan_impl = scan_delims_avx2;
+        scan_name = "avx2";
+    }
+#endif
+    else{
+        return -1;
+    }
+    return 0;
+}
+
+void scan_init(void){
+    /* the widest implementation the CPU supports */
+    if (scan_use("avx2") < 0 && scan_use("sse2") < 0)
+        scan_use("scalar");
+    DPRINTF(DEBUG_INIT,"scan_delims: using %s implementation\n",scan_name);
+}
+
+void linescan_init(linescan_t *ls, char *buf, unsigned len){
+    ls->buf = buf;
+    ls->len = len;
+    ls->cursor = 0;
+    ls->next = 0;
+    ls->count = scan_delims(buf, len, ls->pos);
+}
+
+int linescan_next(linescan_t *ls, scanned_line_t *out){
+    int i;
+
+    for (;;){
+        unsigned start = ls->cursor;
+        int first = ls->next;
+
+        /* find this line's terminator among the indexed delimiters */
+        for (i = first; i < ls->count; i++){
+            char c = ls->buf[ls->pos[i]];
+            if (c == '\r' || c == '\n')
+                break;
+        }
+        if (i == ls->count)
+            return FALSE; /* unterminated tail */
+
+        ls->buf[ls->pos[i]] = '\0';
+        ls->cursor = ls->pos[i] + 1;
+        ls->next = i + 1;
+        if (ls->pos[i] == start)
+            continue; /* empty line: second half of CRLF, or a blank line */
+
+        out->line = ls->buf + start;
+        out->len = ls->pos[i] - start;
+        out->delims = ls->pos + first;
+        out->numDelims = i - first;
+        out->base = start;
+        return TRUE;
+    }
+}
@@ -0,0 +1,52 @@
+#ifndef _SCAN_H_
+#define _SCAN_H_
+
+/** SCAN_H
+ *
+ *  One-pass delimiter index of a receive buffer.
+ *
+ *  scan_delims() records the offset of every CR, LF, SPACE and ':' of a buffer,
+ *  16 (SSE2) or 32 (AVX2, picked at runtime) bytes at a time. Line framing and the
+ *  prefix/command/params split of parse_scanned_line both walk this index instead of
+ *  rescanning the bytes with strpbrk/strchr/strstr.
+ **/
+
+#include "common.h"
+
+/* scan_delims: stores offsets (ascending) of CR, LF, ' ' and ':' in buf[0..len) into pos,
+ *              which must hold len entries. returns number stored */
+int scan_delims(const char *buf, unsigned len, unsigned short *pos);
+/* scan_init: picks the widest implementation the CPU supports (scalar until then).
+ *            once, before any thread that scans starts */
+void scan_init(void);
+/* scan_use: forces the implementation named "avx2", "sse2" or "scalar" (scanbench).
+ *           -1 if this CPU or build does not have it */
+int scan_use(const char *name);
+
+/* a received buffer being cut into lines */
+typedef struct {
+    char *buf;
+    unsigned len;
+    unsigned cursor;   /* first byte not handed out yet */
+    int next;          /* first index entry at or after cursor */
+    int count;
+    unsigned short pos[MAX_MSG_LEN];
+} linescan_t;
+
+/* one complete line. delims are this line's SPACE and ':' offsets, relative to line */
+typedef struct {
+    char *line;        /* NUL terminated in place */
+    unsigned len;
+    const unsigned short *delims;
+    int numDelims;
+    unsigned base;     /* offset of line inside the buffer: delims[i] - base is relative to line */
+} scanned_line_t;
+
+/* linescan_init: indexes buf[0..len) (len <= MAX_MSG_LEN) */
+void linescan_init(linescan_t *ls, char *buf, unsigned len);
+/* linescan_next: NUL terminates the next complete line in place and describes it in out.
+ *                Empty lines are skipped. Returns FALSE once only an unterminated tail
+ *                (starting at ls->cursor) is left */
+int linescan_next(linescan_t *ls, scanned_line_t *out);
+
+#endif /* _SCAN_H_ */
@@ -0,0 +1,146 @@
+/** scanbench
+ *
+ *  Lines per second of the receive path's framing (scan.h), per
+ *  implementation of the delimiter index, on the same input.
+ *
+ *  A stream of client lines (mostly PRIVMSG, some JOIN/PING/WHO, with
+ *  CRLF or bare LF) is cut into recv()-sized reads of MAX_MSG_LEN bytes.
+ *  Every read is copied into a read buffer behind the unterminated tail of
+ *  the previous one and cut into lines with linescan_init/linescan_next,
+ *  the way worker.c does. Each implementation runs over the whole stream
+ *  R times and must find the same number of lines and delimiters.
+ *
+ *  make scanbench && ./scanbench [-n lines] [-r rounds] [-s seed]
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "scan.h"
+
+static const char *impls[] = { "scalar", "sse2", "avx2" };
+
+static const char *words[] = {
+    "hello", "world", "the", "server", "is", "fast", "today", "channel",
+    "message", "a", "lorem", "ipsum", "dolor", "sit", "amet", "ok:",
+};
+
+/* one random client line, terminator included, into out. returns its length */
+static int make_line(char *out, int n){
+    int len, i, numWords = 1 + rand() % 24;
+    int kind = rand() % 16;
+
+    if (kind == 0)
+        len = sprintf(out, "JOIN #chan%d", rand() % 100);
+    else if (kind == 1)
+        len = sprintf(out, "PING :irc.example.net");
+    else if (kind == 2)
+        len = sprintf(out, "WHO #chan%d", rand() % 100);
+    else
+        len = sprintf(out, "PRIVMSG #chan%d :", rand() % 100);
+    if (kind > 2){
+        for (i = 0; i < numWords && len < n - 32; i++)
+            len += sprintf(out + len, "%s%s", i ? " " : "", words[rand() % 16]);
+    }
+    len += sprintf(out + len, rand() % 4 ? "\r\n" : "\n");
+    return len;
+}
+
+static double now(void){
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* one pass over stream. counts lines and their delimiters */
+static void run(const char *stream, size_t size, unsigned long *lines, unsigned long *delims){
+    static linescan_t scan;
+    char readbuf[MAX_MSG_LEN+1];
+    unsigned tail = 0;
+    size_t off = 0;
+
+    while (off < size){
+        unsigned nbytes = size - off < MAX_MSG_LEN - tail ? size - off : MAX_MSG_LEN - tail;
+        scanned_line_t line;
+
+        memcpy(readbuf + tail, stream + off, nbytes);
+        off += nbytes;
+        linescan_init(&scan, readbuf, tail + nbytes);
+        while (linescan_next(&scan, &line)){
+            (*lines)++;
+            *delims += line.numDelims;
+        }
+        tail = scan.len - scan.cursor;
+        if (tail == MAX_MSG_LEN)
+            tail = 0;
+        memmove(readbuf, readbuf + scan.cursor, tail);
+    }
+}
+
+int main(int argc, char *argv[]){
+    unsigned long numLines = 1000000, firstLines = 0, firstDelims = 0;
+    int rounds = 5, seed = 1, ch, i, r;
+    size_t size = 0, cap;
+    char *stream;
+
+    while ((ch = getopt(argc, argv, "n:r:s:")) != -1){
+        switch (ch){
+        case 'n': numLines = strtoul(optarg, NULL, 10); break;
+        case 'r': rounds = atoi(optarg); break;
+        case 's': seed = atoi(optarg); break;
+        default:
+            fprintf(stderr, "scanbench [-n lines] [-r rounds] [-s seed]\n");
+            return 1;
+        }
+    }
+    if (numLines == 0 || rounds <= 0)
+        return 1;
+
+    cap = 64 * MAX_MSG_LEN;
+    stream = malloc(cap);
+    srand(seed);
+    for (i = 0; (unsigned long)i < numLines; i++){
+        if (stream && cap - size < MAX_MSG_LEN)
+            stream = realloc(stream, cap *= 2);
+        if (!stream){
+            perror("malloc");
+            return 1;
+        }
+        size += make_line(stream + size, MAX_MSG_LEN);
+    }
+    printf("%lu lines, %zu bytes (%.1f per line), %d rounds\n",
+           numLines, size, (double)size / numLines, rounds);
+
+    for (i = 0; i < (int)(sizeof(impls) / sizeof(impls[0])); i++){
+        unsigned long lines = 0, delims = 0;
+        double t0, dt;
+
+        if (scan_use(impls[i]) < 0){
+            printf("%-7s not supported here\n", impls[i]);
+            continue;
+        }
+        run(stream, size, &lines, &delims); /* warm up */
+        lines = delims = 0;
+        t0 = now();
+        for (r = 0; r < rounds; r++)
+            run(stream, size, &lines, &delims);
+        dt = now() - t0;
+
+        if (!firstLines){
+            firstLines = lines;
+            firstDelims = delims;
+        }
+        else if (lines != firstLines || delims != firstDelims){
+            fprintf(stderr, "%s: %lu lines %lu delimiters, expected %lu and %lu\n",
+                    impls[i], lines, delims, firstLines, firstDelims);
+            return 1;
+        }
+        printf("%-7s %.3f s, %.2f M lines/s, %.0f MB/s\n",
+               impls[i], dt, lines / dt / 1e6, (double)size * rounds / dt / 1e6);
+    }
+    free(stream);
+    return 0;
+}
@@ -11,30 +11,50 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <signal.h>
+#include <sys/resource.h>
+#include <pthread.h>
 
 #include "debug.h"
 #include "rtlib.h"
 #include "rtgrading.h"
 #include "common.h"
 #include "irc_proto.h"
-#include "arraylist.h"
+#include "scan.h"
 #include "sircd.h"
+#include "event.h"
+#include "pool.h"
+#include "resolver.h"
+#include "worker.h"
+#include "replygen.h"
+
+#define MAX_MAILS_PER_ROUND 64 /* mails from the workers handled per loop iteration */
+#define SHIP_RETRY_MS 1 /* wait before shipping again to a full worker mailbox */
 
 u_long curr_nodeID;
 rt_config_file_t   curr_node_config_file;  /* The config_file  for this node */
 rt_config_entry_t *curr_node_config_entry; /* The config_entry for this node */
+event_loop_t *event_loop; /* readiness notification of the core: worker mail and resolver */
+int maxChannelsPerClient = DEFAULT_MAX_CHANNELS;
+static volatile sig_atomic_t poolReportWanted = 0; /* set by SIGUSR1 */
 
 void init_node(char *nodeID, char *config_file);
 void irc_server();
-const Boolean clientEquals(const Object obj1, const Object obj2);
-int handle_incoming_conn(Arraylist list, char *servername, int listenfd);
+void handle_worker_mail(clientvec_t *clientList, chanvec_t *channelList, char *servername);
+int raise_fd_limit();
+void request_pool_report(int sig);
 
 void
 usage() {
-  fprintf(stderr, "sircd [-h] [-D debug_lvl] <nodeID> <config file>\n");
+  fprintf(stderr, "sircd [-h] [-D debug_lvl] [-e epoll|select] [-c max_channels] [-t io_threads] [-r] [-R dns_stub] <nodeID> <config file>\n");
   exit(-1);
 }
 
+/* SIGUSR1: the main loop prints allocator counters once it wakes up */
+void request_pool_report(int sig){
+  (void)sig;
+  poolReportWanted = 1;
+}
+
 /* calls getaddrinfo(), socket(), bind(), listen()
   on error, prints relevant error messages using fprintf or perror,
             and return -1*/
@@ -81,6 +101,11 @@ int setupListenSocket(unsigned long protocol){
     perror("setsockopt");
     return -1;
   }
+  /* one listener per I/O worker on the same port. the kernel balances them */
+  if (setsockopt(listenfd,SOL_SOCKET,SO_REUSEPORT,&yes,sizeof(int)) < 0){
+    perror("setsockopt");
+    return -1;
+  }
 
   /* bind */
   if (bind(listenfd, res->ai_addr, res->ai_addrlen) < 0){
@@ -99,28 +124,78 @@ int setupListenSocket(unsigned long protocol){
   return listenfd;
 }
 
-/* Handle incoming connection */
-/* accept(), create new client and add to list */
-/* returns index of new client on the list */
-int handle_incoming_conn(Arraylist list, char *servername, int listenfd){
-  /* Incoming Connection */
-  struct sockaddr_storage remoteaddr;
-  socklen_t addrlen = sizeof(remoteaddr);
-  int newfd = accept(listenfd, (struct sockaddr *)&remoteaddr, &addrlen);
-
-  if (newfd == -1) {
-    DEBUG_PERROR("accept");
-    return -1;
-  }
+/* Handle what the I/O workers sent: new connections, parsed lines, hangups
+   and drained out queues. At most MAX_MAILS_PER_ROUND mails, so replies go
+   out while the workers keep posting */
+void handle_worker_mail(clientvec_t *clientList, chanvec_t *channelList, char *servername){
+  mail_t *mails[MAX_MAILS_PER_ROUND];
+  int i, numMails;
+
+  mailbox_ack(&coreInbox);
+  numMails = mailbox_take(&coreInbox, mails, MAX_MAILS_PER_ROUND);
+  for (i = 0; i < numMails; i++){
+    mail_t *mail = mails[i];
+    record_t *rec;
 
-  DPRINTF(DEBUG_SOCKETS,"handle_incoming_conn: new connection on socket %d\n",newfd);
+    for (rec = mail_first(mail); rec; rec = mail_next(mail, rec)){
+      client_t *client;
+      parsed_line_t parsed;
 
-  return addClientToList(list, servername, newfd, &remoteaddr);
+      if (rec->type == REC_CONNECT){
+        rec_connect_t *conn = (rec_connect_t *)rec;
+
+        addClientToList(clientList, servername, conn->worker, rec->fd, rec->serial, &conn->addr);
+        continue;
+      }
+      /* dropped meanwhile: whatever was in flight for it is moot */
+      client = findClientBySockFD(rec->fd);
+      if (!client || client->info->serial != rec->serial)
+        continue;
+      switch (rec->type){
+      case REC_LINE:
+        rec_line_parse((rec_line_t *)rec, &parsed);
+        dispatch_line(clientList, client, channelList, servername, &parsed);
+        break;
+      case REC_CLOSED:
+        remove_client(clientList, channelList, client);
+        break;
+      case REC_DRAINED:
+        /* long replies continue as the client keeps up with them */
+        if (client->replying)
+          replygen_resume(client);
+        break;
+      default:
+        DPRINTF(DEBUG_ERRS,"handle_worker_mail: unexpected record %u\n",rec->type);
+        break;
+      }
+    }
+    mail_free(mail);
+  }
+  /* maybe not drained yet. no new wakeup would come for what is left */
+  if (numMails == MAX_MAILS_PER_ROUND)
+    event_pend(event_loop, mailbox_fd(&coreInbox), EV_READ);
 }
 
+/* raise the soft descriptor limit to the hard one so the loop can hold as many
+   clients as the box allows. returns resulting limit */
+int raise_fd_limit(){
+  struct rlimit rl;
 
-fd_set master_set;
-fd_set write_set;
+  if (getrlimit(RLIMIT_NOFILE, &rl) < 0){
+    DEBUG_PERROR("getrlimit");
+    return FD_SETSIZE;
+  }
+  if (rl.rlim_cur < rl.rlim_max){
+    rl.rlim_cur = rl.rlim_max;
+    if (setrlimit(RLIMIT_NOFILE, &rl) < 0){
+      DEBUG_PERROR("setrlimit");
+      getrlimit(RLIMIT_NOFILE, &rl);
+    }
+  }
+  if (rl.rlim_cur == RLIM_INFINITY || rl.rlim_cur > MAX_EVENT_FDS)
+    return MAX_EVENT_FDS;
+  return (int)rl.rlim_cur;
+}
 
 
 int main( int argc, char *argv[] )
@@ -131,28 +206,59 @@ int main( int argc, char *argv[] )
   int ch;
 
   /* vars */
-  int i,j;
-  int listenfd;
-
-  /* select vars */
-  fd_set read_set;
-  int fdmax;
+  int i;
+  int listenfds[MAX_WORKERS];
+  int numWorkers = 0;
+  int maxfds;
+  int resolverfd;
+  resolver_lookup_fn lookup = NULL;
+  int inboxfd;
+  int shipWaiting = 0; /* workers whose mailbox was full at the last ship */
+  int inboxHeld = 0; /* mail from the workers waits until they caught up */
+
+  /* event loop vars */
+  char *backend = NULL;
+  ev_fired_t *fired;
+  struct sigaction sa;
+  sigset_t blocked, saved;
 
   /* client arr */
-  Arraylist clientList;
+  clientvec_t clientList;
   /* channel arr */
-  Arraylist channelList;
+  chanvec_t channelList;
 
   /* servername */
   char servername[MAX_SERVERNAME+1];
 
-  while ((ch = getopt(argc, argv, "hD:")) != -1)
+  while ((ch = getopt(argc, argv, "hD:e:c:t:rR:")) != -1)
   switch (ch) {
   case 'D':
     if (set_debug(optarg)) {
       exit(0);
     }
     break;
+  case 'e':
+    backend = optarg;
+    break;
+  case 'c':
+    maxChannelsPerClient = atoi(optarg);
+    if (maxChannelsPerClient <= 0 || maxChannelsPerClient > MAX_CHANNELS_LIMIT)
+      usage();
+    break;
+  case 't':
+    numWorkers = atoi(optarg);
+    if (numWorkers <= 0 || numWorkers > MAX_WORKERS)
+      usage();
+    break;
+  case 'r':
+    /* give empty slabs back to the OS instead of keeping them for the next burst */
+    pool_set_release(TRUE);
+    break;
+  case 'R':
+    /* reverse DNS from a table instead (resolver.h), to test the cache */
+    if (!(lookup = resolver_stub(optarg)))
+      exit(EXIT_FAILURE);
+    break;
   case 'h':
   default: /* FALLTHROUGH */
     usage();
@@ -164,6 +270,11 @@ int main( int argc, char *argv[] )
     usage();
   }
   signal(SIGPIPE, SIG_IGN);
+  /* no SA_RESTART, so a blocked event_wait returns to notice the request */
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = request_pool_report;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGUSR1, &sa, NULL);
   init_node(argv[0], argv[1]);
 
   printf( "I am node %lu and I listen on port %d for new users\n", curr_nodeID, curr_node_config_entry->irc_port );
@@ -175,172 +286,99 @@ int main( int argc, char *argv[] )
   }
   servername[MAX_SERVERNAME] = '\0';
 
+  /* one I/O worker per CPU unless told otherwise */
+  if (numWorkers == 0){
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    numWorkers = cpus < 1 ? 1 : cpus > MAX_WORKERS ? MAX_WORKERS : (int)cpus;
+  }
+
   /* delegate all function calling to setupListenSocket.
         It should print out relevant err messages. */
-  listenfd = setupListenSocket(curr_node_config_entry->irc_port);
-  if (listenfd < 0){
-    return EXIT_FAILURE;
+  for (i = 0; i < numWorkers; i++){
+    listenfds[i] = setupListenSocket(curr_node_config_entry->irc_port);
+    if (listenfds[i] < 0){
+      return EXIT_FAILURE;
+    }
   }
 
   /* initialize client array */
-  clientList = arraylist_create();
+  clientvec_init(&clientList);
 
   /* initialize channel array */
-  channelList = arraylist_create();
+  chanvec_init(&channelList);
+  initChannelIds();
 
-  /* prepare for select */
-  fdmax = listenfd;
-  FD_ZERO(&master_set);
-  FD_ZERO(&write_set);
-  FD_SET(listenfd,&master_set);
+  /* prepare event loop and the client table, both indexed by descriptor */
+  maxfds = raise_fd_limit();
+  if (initClientTable(maxfds) < 0){
+    fprintf(stderr, "sircd: failed to allocate client table for %d descriptors\n", maxfds);
+    return EXIT_FAILURE;
+  }
+  event_loop = event_loop_create(backend, maxfds);
+  if (!event_loop){
+    fprintf(stderr, "sircd: failed to create event loop (backend %s)\n", backend ? backend : EV_DEFAULT_BACKEND);
+    return EXIT_FAILURE;
+  }
 
-  /* FD_ZERO(&write_set);  initially no data to write */
+  /* the workers share the scanner: it is picked before they start */
+  scan_init();
+
+  /* threads started from here on leave SIGUSR1 to this one */
+  sigfillset(&blocked);
+  pthread_sigmask(SIG_BLOCK, &blocked, &saved);
+  numWorkers = workers_start(numWorkers, listenfds, backend, maxfds);
+  /* reverse DNS answers come back through resolverfd; without it hosts stay numeric */
+  resolverfd = resolver_start(RESOLVER_THREADS, lookup);
+  pthread_sigmask(SIG_SETMASK, &saved, NULL);
+
+  if (numWorkers < 0){
+    fprintf(stderr, "sircd: failed to start I/O workers\n");
+    return EXIT_FAILURE;
+  }
+  inboxfd = mailbox_fd(&coreInbox);
+  if (event_add(event_loop, inboxfd, EV_READ) < 0){
+    perror("event_add");
+    return EXIT_FAILURE;
+  }
+  if (resolverfd < 0 || event_add(event_loop, resolverfd, EV_READ) < 0)
+    fprintf(stderr, "sircd: reverse DNS unavailable, using numeric hosts\n");
 
   /* main loop!! */
   for (;;){
-    int retval;
-    read_set = master_set;
-
     /* wait until any sockets become available */
-    retval = select(fdmax+1,&read_set,&write_set,NULL,NULL);
+    int numFired = event_wait(event_loop, &fired, shipWaiting ? SHIP_RETRY_MS : -1);
 
-    if (retval <= 0){
-      if (retval < 0)
-      DEBUG_PERROR("select");
-      continue; /* handle errors gracefully and wait again if timed out (it shouldn't)*/
+    if (poolReportWanted){
+      poolReportWanted = 0;
+      pool_report();
+    }
+    if (numFired < 0){
+      if (errno != EINTR)
+        DEBUG_PERROR("event_wait");
+      numFired = 0; /* handle errors gracefully. a timeout retries the full mailboxes */
     }
-    /* at least one socket ready*/
-    for (i = 0; i <= fdmax; i++){
-      if (FD_ISSET(i, &write_set)) {
-        int listIndex = findClientIndexBySockFD(clientList,i);
-        client_t *thisClient = (client_t *) CLIENT_GET(clientList,listIndex);
-        /*client data ready to be written */
-        int nbytes;
-        /* iterate through item to be sent, until it will block */
-        Arraylist outbuf = thisClient->outbuf;
-
-        while (!arraylist_is_empty(outbuf))
-        {
-          /* write */
-          char *dataToSend = (char *) (arraylist_get(outbuf,0)) + thisClient->outbuf_offset;
-          size_t sizeToSend = strlen(dataToSend);
-          nbytes = send(thisClient->sock, dataToSend, sizeToSend, 0);
-          if (nbytes <0){
-            /* error */
-            if (errno == EPIPE || errno == ECONNRESET){
-              /* connection lost or closed by the peer */
-
-              DPRINTF(DEBUG_SOCKETS,"send: client %d hungup\n",i);
-              remove_client(clientList,listIndex);
-              continue;
-            }
-          }
-          else if (nbytes == sizeToSend){
-            /* current line completely sent */
-            char *toRemove = (char *) (arraylist_get(outbuf,0));
-            arraylist_removeIndex(outbuf,0);
-            free(toRemove);
-          }
-          else{
-            /* partial send */
-            thisClient->outbuf_offset += nbytes;
-            break;
-          }
-        }
-        if (arraylist_is_empty(outbuf))
-          FD_CLR(i, &write_set);
+    /* only ready sockets are visited */
+    for (i = 0; i < numFired; i++){
+      int fd = fired[i].fd;
+
+      if (fd == inboxfd){
+        /* connections, lines and hangups from the I/O workers. Replies to them
+           would only pile up for a worker that is behind */
+        if (workers_backlogged())
+          inboxHeld = 1;
+        else
+          handle_worker_mail(&clientList, &channelList, servername);
       }
-      if (FD_ISSET(i, &read_set)) {
-        if (i == listenfd){
-          /* incoming connection */
-          int newindex = handle_incoming_conn(clientList,servername,listenfd);
-          if (newindex < 0){
-            continue;
-          }
-          client_t *newClient = CLIENT_GET(clientList,newindex);
-          int newfd = newClient->sock;
-          FD_SET(newfd,&master_set);
-          if (newfd > fdmax){
-            fdmax = newfd;
-          }
-        }
-        else{
-          /* client data ready */
-          char *tempPtr;
-          int listIndex = findClientIndexBySockFD(clientList,i);
-
-          /* for split function */
-          char** tokenArr;
-          int numToken;
-          int lastTokenTerminated;
-
-          if (listIndex < 0){
-            close(i);
-            FD_CLR(i,&master_set);
-            continue;
-          }
-
-          int nbytes = recv(i, CLIENT_GET(clientList,listIndex)->inbuf + CLIENT_GET(clientList,listIndex)->inbuf_size,
-          MAX_MSG_LEN - CLIENT_GET(clientList,listIndex)->inbuf_size, 0);
-
-          /* recv failed. Either client left or error */
-          if (nbytes <= 0){
-            if (nbytes == 0){
-              DPRINTF(DEBUG_SOCKETS,"recv: client %d hungup\n",i);
-              remove_client(clientList, listIndex);
-
-            }
-            else if (errno == ECONNRESET || errno == EPIPE){
-              DPRINTF(DEBUG_SOCKETS,"recv: client %d connection reset \n",i);
-              remove_client(clientList, listIndex);
-
-            }
-            else{
-              perror("recv");
-            }
-            continue;
-          }
-
-          /* NULL terminate to use strpbrk */
-          CLIENT_GET(clientList,listIndex)->inbuf_size += nbytes;
-          CLIENT_GET(clientList,listIndex)->inbuf[CLIENT_GET(clientList,listIndex)->inbuf_size] = '\0';
-          tempPtr = strpbrk(CLIENT_GET(clientList,listIndex)->inbuf,"\r\n");
-          if (!tempPtr){
-            if (CLIENT_GET(clientList,listIndex)->inbuf_size == MAX_MSG_LEN){
-              /* Message too long. Dump the content */
-              DPRINTF(DEBUG_INPUT,"recv: message longer than MAX_MESSAGE detected. The message will be discarded\n");
-              CLIENT_GET(clientList,listIndex)->inbuf_size = 0;
-            }
-            continue;
-          }
-
-          tokenArr = splitByDelimStr(CLIENT_GET(clientList,listIndex)->inbuf,"\r\n",&numToken,&lastTokenTerminated);
-          /* since we have checked if there's delimeter beforehand, there should be at least one terminated token available*/
-          if (!tokenArr){
-            DPRINTF(DEBUG_INPUT,"splitByDelimStr: failed to split inputToken\n");
-            CLIENT_GET(clientList,listIndex)->inbuf_size = 0;
-            continue;
-          }
-          if (!lastTokenTerminated){
-            CLIENT_GET(clientList,listIndex)->inbuf_size = strlen(tokenArr[numToken-1]);
-            memcpy(CLIENT_GET(clientList,listIndex)->inbuf,tokenArr[numToken-1],CLIENT_GET(clientList,listIndex)->inbuf_size);
-            numToken--;
-          }
-
-          for (j=0;j<numToken;j++){
-            handle_line(clientList,listIndex,channelList,servername,tokenArr[j]);
-          }
-
-          for (j = 0; j < arraylist_size(clientList); j++){
-            client_t *client = CLIENT_GET(clientList,j);
-            if (arraylist_size(client->outbuf)){
-                FD_SET(client->sock,&write_set);
-            }
-          }
-          freeTokens(&tokenArr,numToken);
-        }
+      else if (fd == resolverfd){
+        resolver_complete(setResolvedHost);
       }
     }
+    /* replies queued during this round go to the workers in one mail each */
+    shipWaiting = workers_ship();
+    if (inboxHeld && !workers_backlogged()){
+      inboxHeld = 0;
+      event_pend(event_loop, inboxfd, EV_READ);
+    }
   }
 
   return 0;
@@ -373,10 +411,3 @@ init_node(char *nodeID, char *config_file)
   }
 }
 
-const Boolean clientEquals(const Object obj1, const Object obj2){
-  client_t *c1 = (client_t *)obj1;
-  client_t *c2 = (client_t *)obj2;
-  /* simple comparison of sockfds */
-  return (c1->sock == c2->sock) ? TRUE : FALSE;
-}
-
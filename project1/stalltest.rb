@@ -0,0 +1,79 @@
+#! /usr/local/bin/env ruby
+#
+# Stalled read test. A worker stops reading its clients while the core is
+# behind and reads them again once it caught up. This stalls more clients
+# than one round can hand back at once, so every one of them has to be
+# picked up over several rounds. Runs against a server built with
+# two-mail mailboxes, given its pid to stop it while the clients send:
+#
+#   make clean && make CFLAGS="-Wall -DDEBUG -g -DMAILBOX_SLOTS=2"
+#   ./sircd 1 node1.conf & ruby stalltest.rb 20102 $!
+#
+# Every client sends a burst of WHOs while the server is stopped and must
+# get its end of WHO once it runs again.
+
+require 'socket'
+
+$SERVER = "127.0.0.1"
+$PORT = 20102
+$CLIENTS = 3000
+
+if ARGV.size < 2
+    puts "stalltest.rb port pid [clients]"
+    exit 1
+end
+$PORT = Integer(ARGV[0])
+$PID = Integer(ARGV[1])
+if ARGV.size >= 3
+    $CLIENTS = Integer(ARGV[2])
+end
+
+# reads sock until a line matching re, false once timeout ran out
+def wait_for(sock, re, deadline)
+    buf = ""
+    loop do
+        left = deadline - Time.now
+        return false if left <= 0 || !IO.select([sock], nil, nil, left)
+        begin
+            buf << sock.read_nonblock(4096)
+        rescue IO::WaitReadable
+            next
+        rescue EOFError, SystemCallError
+            return false
+        end
+        while (i = buf.index("\n"))
+            return true if buf.slice!(0..i) =~ re
+        end
+    end
+end
+
+socks = []
+$CLIENTS.times do |i|
+    s = TCPSocket.new($SERVER, $PORT)
+    s.send "NICK st#{i}\r\nUSER st#{i} * * :st#{i}\r\n", 0
+    socks << s
+end
+deadline = Time.now + 60
+registered = socks.count { |s| wait_for(s, / 376 /, deadline) }
+if registered != $CLIENTS
+    puts "(-) REGISTER: #{registered} of #{$CLIENTS}"
+    exit 1
+end
+puts "(+) REGISTER: #{registered}"
+
+# all of them readable at once when the server comes back
+Process.kill("STOP", $PID)
+socks.each_with_index { |s, i| s.send "WHO stall#{i}\r\n" * 20, 0 }
+Process.kill("CONT", $PID)
+
+deadline = Time.now + 30
+answered = 0
+socks.each_with_index { |s, i| answered += 1 if wait_for(s, / 315 stall#{i} /, deadline) }
+socks.each { |s| s.close }
+
+if answered == $CLIENTS
+    puts "(+) ENDOFWHO: #{answered}\n\nall passed"
+    exit 0
+end
+puts "(-) ENDOFWHO: #{answered} of #{$CLIENTS}\n\n1 failed"
+exit 1
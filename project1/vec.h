@@ -0,0 +1,129 @@
+#ifndef _VEC_H_
+#define _VEC_H_
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+/** VEC_H
+ *
+ *  Type-specialized growable arrays, generated by VEC_DEFINE(name, type, inline_cap):
+ *
+ *    name_t                          the vector, with room for inline_cap elements inline
+ *    name_init(v) / name_free(v)
+ *    name_size(v) / name_get(v, i)   elements are also plain v->data[0..size-1]
+ *    name_reserve(v, n)              room for n more elements. -1 if out of memory
+ *    name_push(v, item)              appends. returns its index, -1 if out of memory
+ *    name_swap_remove(v, i)          removes element i in O(1) by moving the last one
+ *                                    into its place. returns the removed element
+ *    name_clear(v)                   empties v, keeping its memory for reuse
+ *    name_truncate(v, n)             keeps the first n elements, e.g. after
+ *                                    compacting the ones to keep into data[0..n-1]
+ *
+ *  Capacity doubles on growth, and halves only once the vector is down to a
+ *  quarter full, so add/remove at a boundary never reallocates back and forth.
+ *  A vector small enough for its inline storage needs no heap block at all.
+ *  Since data may point into the vector itself, a vector must not be copied
+ *  or moved once initialized.
+ **/
+
+#define VEC_DEFINE(name, type, inline_cap)                                      \
+typedef struct {                                                                \
+    type *data;                 /* inline_data, or heap block while grown */    \
+    int size;                                                                   \
+    int capacity;                                                               \
+    type inline_data[inline_cap];                                               \
+} name##_t;                                                                     \
+                                                                                \
+static inline void name##_init(name##_t *v){                                    \
+    v->data = v->inline_data;                                                   \
+    v->size = 0;                                                                \
+    v->capacity = (inline_cap);                                                 \
+}                                                                               \
+                                                                                \
+static inline void name##_free(name##_t *v){                                    \
+    if (v->data != v->inline_data)                                              \
+        free(v->data);                                                          \
+    name##_init(v);                                                             \
+}                                                                               \
+                                                                                \
+static inline int name##_size(const name##_t *v){                               \
+    return v->size;                                                             \
+}                                                                               \
+                                                                                \
+static inline type name##_get(const name##_t *v, int index){                    \
+    return v->data[index];                                                      \
+}                                                                               \
+                                                                                \
+static inline int name##_reserve(name##_t *v, int n){                           \
+    int newCapacity = v->capacity;                                              \
+    type *newData;                                                              \
+                                                                                \
+    if (v->size + n <= v->capacity)                                             \
+        return 0;                                                               \
+    while (newCapacity < v->size + n){                                          \
+        if (newCapacity > INT_MAX / 2)                                          \
+            return -1;                                                          \
+        newCapacity *= 2;                                                       \
+    }                                                                           \
+    if (v->data == v->inline_data){                                             \
+        newData = malloc(newCapacity * sizeof(type));                           \
+        if (newData)                                                            \
+            memcpy(newData, v->data, v->size * sizeof(type));                   \
+    }                                                                           \
+    else{                                                                       \
+        newData = realloc(v->data, newCapacity * sizeof(type));                 \
+    }                                                                           \
+    if (!newData)                                                               \
+        return -1;                                                              \
+    v->data = newData;                                                          \
+    v->capacity = newCapacity;                                                  \
+    return 0;                                                                   \
+}                                                                               \
+                                                                                \
+static inline int name##_push(name##_t *v, type item){                          \
+    if (v->size == v->capacity && name##_reserve(v, 1) < 0)                     \
+        return -1;                                                              \
+    v->data[v->size] = item;                                                    \
+    return v->size++;                                                           \
+}                                                                               \
+                                                                                \
+/* halve capacity once a quarter full, back to inline storage if it fits */     \
+static inline void name##_shrink(name##_t *v){                                  \
+    int newCapacity = v->capacity / 2;                                          \
+                                                                                \
+    if (v->data == v->inline_data || v->size >= v->capacity / 4)               \
+        return;                                                                 \
+    if (newCapacity <= (inline_cap)){                                           \
+        memcpy(v->inline_data, v->data, v->size * sizeof(type));                \
+        free(v->data);                                                          \
+        v->data = v->inline_data;                                               \
+        v->capacity = (inline_cap);                                             \
+    }                                                                           \
+    else{                                                                       \
+        type *newData = realloc(v->data, newCapacity * sizeof(type));           \
+        if (newData){                                                           \
+            v->data = newData;                                                  \
+            v->capacity = newCapacity;                                          \
+        }                                                                       \
+    }                                                                           \
+}                                                                               \
+                                                                                \
+static inline type name##_swap_remove(name##_t *v, int index){                  \
+    type item = v->data[index];                                                 \
+                                                                                \
+    v->data[index] = v->data[--v->size];                                        \
+    name##_shrink(v);                                                           \
+    return item;                                                                \
+}                                                                               \
+                                                                                \
+static inline void name##_clear(name##_t *v){                                   \
+    v->size = 0;                                                                \
+}                                                                               \
+                                                                                \
+static inline void name##_truncate(name##_t *v, int n){                         \
+    if (n < v->size)                                                            \
+        v->size = n;                                                            \
+}
+
+#endif /* _VEC_H_ */
@@ -0,0 +1,106 @@
+/** vecbench
+ *
+ *  vec.h against the arraylist.c it replaced, with pointer elements.
+ *
+ *  build: n pushes (arraylist_add / name_push) into an empty list.
+ *  drain: build, then remove every element from the middle, the way
+ *         members leave a channel: arraylist_removeIndex, which shifts the
+ *         tail down, against name_swap_remove.
+ *  Each is repeated until about R elements were handled and reported in
+ *  nanoseconds per element. arraylist.c is only built into this benchmark.
+ *
+ *  make vecbench && ./vecbench [-r elements per size]
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include "arraylist.h"
+#include "vec.h"
+
+VEC_DEFINE(ptrvec, void *, 4)
+
+static const int sizes[] = { 10, 1000, 10000, 100000 };
+
+static double now(void){
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* keeps the compiler from dropping the lists' contents */
+static volatile unsigned long sink;
+
+static double arraylist_run(int n, int reps, int drain){
+    double t0 = now();
+    int r, i;
+
+    for (r = 0; r < reps; r++){
+        Arraylist list = arraylist_create();
+
+        for (i = 0; i < n; i++)
+            arraylist_add(list, (void *)(unsigned long)(i + 1));
+        if (drain){
+            while (arraylist_size(list) > 0)
+                sink += (unsigned long)arraylist_removeIndex(list, arraylist_size(list) / 2);
+        }
+        else{
+            sink += (unsigned long)arraylist_get(list, n / 2);
+        }
+        arraylist_free(list);
+    }
+    return (now() - t0) / ((double)n * reps) * 1e9;
+}
+
+static double vec_run(int n, int reps, int drain){
+    double t0 = now();
+    int r, i;
+
+    for (r = 0; r < reps; r++){
+        ptrvec_t v;
+
+        ptrvec_init(&v);
+        for (i = 0; i < n; i++)
+            ptrvec_push(&v, (void *)(unsigned long)(i + 1));
+        if (drain){
+            while (ptrvec_size(&v) > 0)
+                sink += (unsigned long)ptrvec_swap_remove(&v, ptrvec_size(&v) / 2);
+        }
+        else{
+            sink += (unsigned long)ptrvec_get(&v, n / 2);
+        }
+        ptrvec_free(&v);
+    }
+    return (now() - t0) / ((double)n * reps) * 1e9;
+}
+
+int main(int argc, char *argv[]){
+    long elements = 2000000;
+    int ch, i;
+
+    while ((ch = getopt(argc, argv, "r:")) != -1){
+        switch (ch){
+        case 'r': elements = atol(optarg); break;
+        default:
+            fprintf(stderr, "vecbench [-r elements per size]\n");
+            return 1;
+        }
+    }
+    if (elements <= 0)
+        return 1;
+
+    printf("      n   build arraylist / vec     build+drain arraylist / vec\n");
+    for (i = 0; i < (int)(sizeof(sizes) / sizeof(sizes[0])); i++){
+        int n = sizes[i];
+        int reps = elements / n > 0 ? elements / n : 1;
+        /* removeIndex is O(n): keep the big arraylist drains to a bounded time */
+        int drainReps = n >= 10000 && reps > 2 ? 2 : reps;
+
+        printf("%7d %7.1f / %.1f ns/elem %12.1f / %.1f ns/elem\n", n,
+               arraylist_run(n, reps, 0), vec_run(n, reps, 0),
+               arraylist_run(n, drainReps, 1), vec_run(n, drainReps, 1));
+    }
+    return 0;
+}
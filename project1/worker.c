@@ -0,0 +1,836 @@
+#define _GNU_SOURCE /* accept4 */
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "worker.h"
+#include "event.h"
+#include "pool.h"
+#include "vec.h"
+#include "debug.h"
+
+/*
+  constants
+*/
+#define MAX_READS_PER_EVENT 16 /* recv() budget of one connection per loop iteration */
+#define FLUSH_MAX_IOV 128      /* segments gathered per sendmsg() */
+#define TAKE_BATCH 64          /* mails taken from the inbox at once */
+#define RETRY_MS 1             /* wait before shipping again to a full mailbox */
+#define CORE_MAX_OVERFLOW 64   /* mails held back for a worker before the core stops taking input */
+#define MAX_SENDQ (1024 * 1024) /* bytes queued for a client before it is dropped as too slow */
+
+/*
+  structures
+*/
+typedef struct slot_s slot_t;
+
+/* one connection in one channel slice. Linked into the connection's list and
+   referenced from the slice, so either side can drop it in O(1) */
+struct slot_s {
+    unsigned chan;
+    int index;              /* position in the slice's members */
+    slot_t *prev, *next;    /* the connection's slices */
+};
+
+typedef struct {
+    int fd;
+    unsigned long serial;
+    unsigned closing : 1;   /* hung up: waiting for REC_CLOSE, nothing goes in or out */
+    unsigned dirty : 1;     /* on the dirty list of its worker */
+    unsigned released : 1;  /* closed while on the dirty or stalled list: the last one frees it */
+    unsigned writing : 1;   /* kernel buffer was full: EV_WRITE armed */
+    unsigned notify : 1;    /* REC_DRAINED wanted once outq is below notifyBelow */
+    unsigned stalled : 1;   /* input left unread while the core's mailbox is full */
+    unsigned inbufSize : 10; /* 0..MAX_MSG_LEN */
+    unsigned notifyBelow;
+    slot_t *slots;          /* channel slices holding it */
+    char *inbuf;            /* unterminated tail of input, NULL while there is none */
+    outq_t outq;
+} conn_t;
+
+VEC_DEFINE(connvec, conn_t *, 16)
+
+typedef struct {
+    conn_t *conn;           /* copy of node's connection: fan-out walks just this array */
+    slot_t *node;
+} slicemember_t;
+
+VEC_DEFINE(slice, slicemember_t, 2)
+
+/* members of one channel on one worker */
+typedef struct {
+    unsigned long gen;      /* of the channel they joined: ids are reused */
+    slice_t members;
+} chanslice_t;
+
+typedef struct {
+    int index;
+    pthread_t thread;
+    int listenfd;
+    event_loop_t *loop;
+    mailbox_t inbox;        /* from the core */
+    outbox_t toCore;
+    connvec_t dirty;        /* connections with data queued this round */
+    connvec_t stalled;      /* connections to read once toCore got through */
+    chanslice_t **slices;   /* by channel id, NULL where no member is ours */
+    unsigned numSlices;
+    char readbuf[MAX_MSG_LEN+1];
+    linescan_t scan;
+} worker_t;
+
+/* records the core sends */
+typedef struct {
+    record_t hdr;
+    unsigned len;
+    char data[];
+} rec_bytes_t;
+
+typedef struct {
+    record_t hdr;
+    payload_t *payload; /* one reference, handed over */
+} rec_payload_t;
+
+typedef struct {
+    record_t hdr;
+    unsigned below;
+} rec_notify_t;
+
+typedef struct {
+    record_t hdr;       /* fd: the member */
+    unsigned chan;      /* channel id */
+    unsigned long gen;  /* channel generation */
+} rec_member_t;
+
+typedef struct {
+    record_t hdr;       /* fd: the member left out, -1 for none */
+    unsigned chan;
+    unsigned long gen;
+    payload_t *payload; /* one reference, handed over */
+} rec_channel_t;
+
+/*
+  state
+*/
+mailbox_t coreInbox;
+unsigned long long coreBytesPosted = 0;
+
+static worker_t *workers;
+static int numWorkers = 0;
+static outbox_t toWorker[MAX_WORKERS]; /* core side */
+
+/* fd-indexed. a descriptor belongs to one worker at a time, so every entry
+   is only ever touched by the worker owning that descriptor. The entries are
+   atomic all the same: a number one worker closes comes back from another
+   worker's accept(), an ordering the C memory model does not see */
+static _Atomic(conn_t *) *connTable;
+static int connTableSize;
+static atomic_ulong connectionSerial = 0;
+
+POOL_THREAD_LOCAL pool_t connPool = POOL_INITIALIZER("conn", sizeof(conn_t));
+POOL_THREAD_LOCAL pool_t slotPool = POOL_INITIALIZER("slot", sizeof(slot_t));
+
+/*
+  worker side
+*/
+static inline conn_t *conn_get(int fd){
+    return atomic_load_explicit(&connTable[fd], memory_order_relaxed);
+}
+
+static inline void conn_set(int fd, conn_t *conn){
+    atomic_store_explicit(&connTable[fd], conn, memory_order_relaxed);
+}
+
+static void conn_mark_dirty(worker_t *w, conn_t *conn){
+    if (conn->dirty)
+        return;
+    if (connvec_push(&w->dirty, conn) >= 0)
+        conn->dirty = 1;
+    else
+        event_add(w->loop, conn->fd, EV_WRITE); /* flushed on the writable edge instead */
+}
+
+static void conn_free(conn_t *conn){
+    outq_free(&conn->outq);
+    free(conn->inbuf);
+    pool_free(&connPool, conn);
+}
+
+/* conn_stall: the core is behind. Read conn again once toCore got through,
+   so clients wait in their socket buffers rather than in our memory */
+static void conn_stall(worker_t *w, conn_t *conn){
+    if (conn->stalled)
+        return;
+    if (connvec_push(&w->stalled, conn) >= 0)
+        conn->stalled = 1;
+    else if (event_pend(w->loop, conn->fd, EV_READ) < 0){
+        /* no room anywhere. registering the read again reports it once more */
+        event_del(w->loop, conn->fd, EV_READ);
+        event_add(w->loop, conn->fd, EV_READ);
+    }
+}
+
+/* stalled connections get their read on the next round. The edge is gone, so
+   a connection that finds the pend list full stays stalled for the round after.
+   A full pend list also means that round comes right away */
+static void worker_resume_reads(worker_t *w){
+    int i, kept = 0;
+
+    for (i = 0; i < connvec_size(&w->stalled); i++){
+        conn_t *conn = connvec_get(&w->stalled, i);
+
+        if (!conn->released && !conn->closing && event_pend(w->loop, conn->fd, EV_READ) < 0){
+            w->stalled.data[kept++] = conn;
+            continue;
+        }
+        conn->stalled = 0;
+        if (conn->released && !conn->dirty)
+            conn_free(conn);
+    }
+    connvec_truncate(&w->stalled, kept);
+}
+
+/* conn_hangup: the connection is dead. The core is told, the descriptor stays
+   open until it answers with REC_CLOSE */
+static void conn_hangup(worker_t *w, conn_t *conn){
+    if (conn->closing)
+        return;
+    conn->closing = 1;
+    event_del(w->loop, conn->fd, EV_READ | EV_WRITE);
+    outq_free(&conn->outq);
+    free(conn->inbuf);
+    conn->inbuf = NULL;
+    conn->inbufSize = 0;
+    outbox_record(&w->toCore, REC_CLOSED, sizeof(record_t), conn->fd, conn->serial);
+}
+
+/* conn_queued: data was added to conn's out queue. A client that does not read
+   what it is sent is dropped once MAX_SENDQ bytes wait for it */
+static void conn_queued(worker_t *w, conn_t *conn){
+    if (outq_size(&conn->outq) > MAX_SENDQ){
+        DPRINTF(DEBUG_SOCKETS,"worker %d: client %d exceeded its send queue. Dropping\n",w->index,conn->fd);
+        conn_hangup(w, conn);
+        return;
+    }
+    conn_mark_dirty(w, conn);
+}
+
+/* conn_flush: sends as much of the out queue as the kernel takes.
+   returns 0 if drained, 1 if data remains (EAGAIN), -1 on connection error */
+static int conn_flush(conn_t *conn){
+    struct iovec iov[FLUSH_MAX_IOV];
+    struct msghdr msg;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+
+    while (!outq_is_empty(&conn->outq)){
+        ssize_t nbytes;
+
+        msg.msg_iovlen = outq_peek(&conn->outq, iov, FLUSH_MAX_IOV);
+        nbytes = sendmsg(conn->fd, &msg, MSG_NOSIGNAL);
+        if (nbytes < 0){
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 1; /* kernel buffer full */
+            /* EPIPE, ECONNRESET or any other hard error: connection is gone */
+            DPRINTF(DEBUG_SOCKETS,"sendmsg: client %d hungup (%s)\n",conn->fd,strerror(errno));
+            return -1;
+        }
+        outq_consume(&conn->outq, nbytes);
+    }
+    return 0;
+}
+
+/* conn_send: flushes conn and keeps EV_WRITE armed only while something is left */
+static void conn_send(worker_t *w, conn_t *conn){
+    int retval = conn_flush(conn);
+
+    if (retval < 0){
+        conn_hangup(w, conn);
+        return;
+    }
+    if (retval > 0 && !conn->writing){
+        conn->writing = 1;
+        event_add(w->loop, conn->fd, EV_WRITE);
+    }
+    else if (retval == 0 && conn->writing){
+        conn->writing = 0;
+        event_del(w->loop, conn->fd, EV_WRITE);
+    }
+    /* a long reply of the core waits for room */
+    if (conn->notify && outq_size(&conn->outq) < conn->notifyBelow){
+        conn->notify = 0;
+        outbox_record(&w->toCore, REC_DRAINED, sizeof(record_t), conn->fd, conn->serial);
+    }
+}
+
+/* optimistic flush of every connection that got data queued this round */
+static void worker_flush_dirty(worker_t *w){
+    int i;
+
+    for (i = 0; i < connvec_size(&w->dirty); i++){
+        conn_t *conn = connvec_get(&w->dirty, i);
+
+        conn->dirty = 0;
+        if (conn->released && !conn->stalled)
+            conn_free(conn);
+        else if (!conn->closing && !conn->writing)
+            conn_send(w, conn); /* a writing one waits for the writable edge */
+    }
+    connvec_clear(&w->dirty);
+}
+
+/* accept() until it would block, announcing every connection to the core */
+static void worker_accept(worker_t *w){
+    for (;;){
+        struct sockaddr_storage remoteaddr;
+        socklen_t addrlen = sizeof(remoteaddr);
+        rec_connect_t *rec;
+        conn_t *conn;
+        int fd = accept4(w->listenfd, (struct sockaddr *)&remoteaddr, &addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+        if (fd == -1){
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                DEBUG_PERROR("accept");
+            return;
+        }
+        DPRINTF(DEBUG_SOCKETS,"worker %d: new connection on socket %d\n",w->index,fd);
+
+        if (fd >= connTableSize || !(conn = pool_alloc(&connPool))){
+            DPRINTF(DEBUG_SOCKETS,"worker %d: cannot take socket %d. Dropping\n",w->index,fd);
+            close(fd);
+            continue;
+        }
+        memset(conn, 0, sizeof(conn_t));
+        conn->fd = fd;
+        conn->serial = atomic_fetch_add_explicit(&connectionSerial, 1, memory_order_relaxed) + 1;
+        outq_init(&conn->outq);
+        if (event_add(w->loop, fd, EV_READ) < 0){
+            DPRINTF(DEBUG_SOCKETS,"worker %d: cannot watch socket %d. Dropping\n",w->index,fd);
+            pool_free(&connPool, conn);
+            close(fd);
+            continue;
+        }
+        rec = (rec_connect_t *)outbox_record(&w->toCore, REC_CONNECT, sizeof(rec_connect_t), fd, conn->serial);
+        if (!rec){
+            event_del(w->loop, fd, EV_READ);
+            pool_free(&connPool, conn);
+            close(fd);
+            continue;
+        }
+        rec->worker = w->index;
+        memcpy(&rec->addr, &remoteaddr, sizeof(remoteaddr));
+        conn_set(fd, conn);
+    }
+}
+
+/* conn_post_line: parses a complete line and passes it on to the core */
+static void conn_post_line(worker_t *w, conn_t *conn, scanned_line_t *line){
+    parsed_line_t parsed;
+    rec_line_t *rec;
+    int i;
+
+    parse_scanned_line(line, &parsed);
+    rec = (rec_line_t *)outbox_record(&w->toCore, REC_LINE, sizeof(rec_line_t) + line->len + 1, conn->fd, conn->serial);
+    if (!rec)
+        return;
+    memcpy(rec->text, line->line, line->len + 1);
+    rec->cmd = parsed.cmd;
+    rec->prefix = parsed.prefix ? parsed.prefix - line->line : -1;
+    rec->command = parsed.command ? parsed.command - line->line : -1;
+    for (i = 0; i < parsed.n_params; i++)
+        rec->params[i] = parsed.params[i] - line->line;
+    rec->n_params = parsed.n_params;
+}
+
+/* Read what is available on conn (at most MAX_READS_PER_EVENT recv()s per round)
+   and hand complete lines to the core. */
+static void conn_read(worker_t *w, conn_t *conn){
+    int numReads;
+
+    for (numReads = 0; ; numReads++){
+        /* lines are framed in one buffer shared by all connections of the worker.
+           only a connection with a partial line pending keeps bytes of its own */
+        scanned_line_t line;
+        int nbytes;
+        unsigned tail;
+
+        if (numReads == MAX_READS_PER_EVENT){
+            /* let the other connections have their turn. not drained yet, so ask for another round */
+            if (event_pend(w->loop, conn->fd, EV_READ) < 0)
+                conn_stall(w, conn);
+            return;
+        }
+        if (conn->inbufSize > 0)
+            memcpy(w->readbuf, conn->inbuf, conn->inbufSize);
+        nbytes = recv(conn->fd, w->readbuf + conn->inbufSize, MAX_MSG_LEN - conn->inbufSize, 0);
+
+        /* recv failed. Either client left or error */
+        if (nbytes <= 0){
+            if (nbytes == 0){
+                DPRINTF(DEBUG_SOCKETS,"recv: client %d hungup\n",conn->fd);
+                conn_hangup(w, conn);
+            }
+            else if (errno == EINTR){
+                continue;
+            }
+            else if (errno == EAGAIN || errno == EWOULDBLOCK){
+                /* drained */
+            }
+            else if (errno == ECONNRESET || errno == EPIPE){
+                DPRINTF(DEBUG_SOCKETS,"recv: client %d connection reset \n",conn->fd);
+                conn_hangup(w, conn);
+            }
+            else{
+                perror("recv");
+            }
+            return;
+        }
+
+        /* index delimiters of readbuf in one pass, then hand out complete lines straight from it */
+        linescan_init(&w->scan, w->readbuf, conn->inbufSize + nbytes);
+        while (linescan_next(&w->scan, &line))
+            conn_post_line(w, conn, &line);
+
+        /* keep the unterminated tail */
+        tail = w->scan.len - w->scan.cursor;
+        if (tail == MAX_MSG_LEN){
+            /* Message too long. Dump the content */
+            DPRINTF(DEBUG_INPUT,"recv: message longer than MAX_MESSAGE detected. The message will be discarded\n");
+            tail = 0;
+        }
+        if (tail > 0 && !conn->inbuf && !(conn->inbuf = malloc(MAX_MSG_LEN))){
+            DPRINTF(DEBUG_ERRS,"recv: no memory for partial line of client %d. Discarded\n",conn->fd);
+            tail = 0;
+        }
+        if (tail > 0){
+            memcpy(conn->inbuf, w->readbuf + w->scan.cursor, tail);
+        }
+        else if (conn->inbuf){
+            free(conn->inbuf);
+            conn->inbuf = NULL;
+        }
+        conn->inbufSize = tail;
+    }
+}
+
+/* slice_of: w's slice of channel chan, generation gen. NULL if w has none */
+static chanslice_t *slice_of(worker_t *w, unsigned chan, unsigned long gen){
+    chanslice_t *slice = chan < w->numSlices ? w->slices[chan] : NULL;
+
+    return slice && slice->gen == gen ? slice : NULL;
+}
+
+/* slot_unlink: takes node off the list of conn and frees it */
+static void slot_unlink(conn_t *conn, slot_t *node){
+    if (node->prev)
+        node->prev->next = node->next;
+    else
+        conn->slots = node->next;
+    if (node->next)
+        node->next->prev = node->prev;
+    pool_free(&slotPool, node);
+}
+
+/* slot_find: conn's slot in the slice of chan, NULL if it has none. O(slices of conn) */
+static slot_t *slot_find(conn_t *conn, unsigned chan){
+    slot_t *node;
+
+    for (node = conn->slots; node; node = node->next){
+        if (node->chan == chan)
+            return node;
+    }
+    return NULL;
+}
+
+/* slice_drop: forgets w's slice of chan along with its members */
+static void slice_drop(worker_t *w, unsigned chan){
+    chanslice_t *slice = w->slices[chan];
+    int i;
+
+    for (i = 0; i < slice_size(&slice->members); i++)
+        slot_unlink(slice->members.data[i].conn, slice->members.data[i].node);
+    slice_free(&slice->members);
+    free(slice);
+    w->slices[chan] = NULL;
+}
+
+/* slice_add: REC_JOIN */
+static void slice_add(worker_t *w, unsigned chan, unsigned long gen, conn_t *conn){
+    slicemember_t member;
+    slot_t *node;
+
+    if (chan >= w->numSlices){
+        unsigned size = w->numSlices ? w->numSlices : 64;
+        chanslice_t **slices;
+
+        while (size <= chan)
+            size *= 2;
+        if (!(slices = realloc(w->slices, size * sizeof(chanslice_t *)))){
+            DPRINTF(DEBUG_ERRS,"worker %d: no room for channel %u\n",w->index,chan);
+            return;
+        }
+        memset(slices + w->numSlices, 0, (size - w->numSlices) * sizeof(chanslice_t *));
+        w->slices = slices;
+        w->numSlices = size;
+    }
+    if (w->slices[chan] && w->slices[chan]->gen != gen){
+        /* left over from an earlier channel under this id: a REC_PART got lost */
+        DPRINTF(DEBUG_ERRS,"worker %d: dropping stale members of channel %u\n",w->index,chan);
+        slice_drop(w, chan);
+    }
+    if (!w->slices[chan]){
+        if (!(w->slices[chan] = malloc(sizeof(chanslice_t)))){
+            DPRINTF(DEBUG_ERRS,"worker %d: no room for channel %u\n",w->index,chan);
+            return;
+        }
+        w->slices[chan]->gen = gen;
+        slice_init(&w->slices[chan]->members);
+    }
+    member.conn = conn;
+    member.node = node = pool_alloc(&slotPool);
+    if (!node || (node->index = slice_push(&w->slices[chan]->members, member)) < 0){
+        DPRINTF(DEBUG_ERRS,"worker %d: failed to add client %d to channel %u\n",w->index,conn->fd,chan);
+        pool_free(&slotPool, node);
+        return;
+    }
+    node->chan = chan;
+    node->prev = NULL;
+    node->next = conn->slots;
+    if (conn->slots)
+        conn->slots->prev = node;
+    conn->slots = node;
+}
+
+/* slice_remove: REC_PART, or conn closed. takes conn, at node, out of its slice */
+static void slice_remove(worker_t *w, conn_t *conn, slot_t *node){
+    unsigned chan = node->chan;
+    chanslice_t *slice = w->slices[chan];
+
+    /* the last member fills the hole */
+    slice_swap_remove(&slice->members, node->index);
+    if (node->index < slice_size(&slice->members))
+        slice->members.data[node->index].node->index = node->index;
+    slot_unlink(conn, node);
+    if (slice_size(&slice->members) == 0)
+        slice_drop(w, chan);
+}
+
+/* worker_deliver: REC_CHANNEL. queues the payload on the slice */
+static void worker_deliver(worker_t *w, rec_channel_t *rec){
+    chanslice_t *slice = slice_of(w, rec->chan, rec->gen);
+    int i;
+
+    for (i = 0; slice && i < slice_size(&slice->members); i++){
+        conn_t *conn = slice->members.data[i].conn;
+
+        if (conn->closing || conn->fd == rec->hdr.fd)
+            continue;
+        if (outq_push_ref(&conn->outq, rec->payload) < 0){
+            DPRINTF(DEBUG_ERRS,"Failed to add a shared message onto outbuf of client %d\n",conn->fd);
+            continue;
+        }
+        conn_queued(w, conn);
+    }
+    payload_release(rec->payload);
+}
+
+/* conn_close: REC_CLOSE. The core forgot the client, so the descriptor may go */
+static void conn_close(worker_t *w, conn_t *conn){
+    /* the core parts a client from its channels before closing it. only a
+       REC_PART lost to lack of memory leaves the connection in a slice */
+    while (conn->slots)
+        slice_remove(w, conn, conn->slots);
+    if (!conn->closing)
+        event_del(w->loop, conn->fd, EV_READ | EV_WRITE);
+    conn_set(conn->fd, NULL);
+    close(conn->fd);
+    if (conn->dirty || conn->stalled){
+        conn->closing = 1;
+        conn->released = 1;
+    }
+    else{
+        conn_free(conn);
+    }
+}
+
+/* handles the records of one mail from the core */
+static void worker_handle_mail(worker_t *w, mail_t *mail){
+    record_t *rec;
+    slot_t *node;
+
+    for (rec = mail_first(mail); rec; rec = mail_next(mail, rec)){
+        conn_t *conn = rec->fd >= 0 && rec->fd < connTableSize ? conn_get(rec->fd) : NULL;
+
+        switch (rec->type){
+        case REC_CLOSE:
+            if (conn)
+                conn_close(w, conn);
+            continue;
+        case REC_CHANNEL:
+            worker_deliver(w, (rec_channel_t *)rec);
+            continue;
+        /* slices are kept right even for connections that hung up */
+        case REC_JOIN:
+            if (conn)
+                slice_add(w, ((rec_member_t *)rec)->chan, ((rec_member_t *)rec)->gen, conn);
+            continue;
+        case REC_PART:
+            if (conn && slice_of(w, ((rec_member_t *)rec)->chan, ((rec_member_t *)rec)->gen)
+                && (node = slot_find(conn, ((rec_member_t *)rec)->chan)))
+                slice_remove(w, conn, node);
+            continue;
+        }
+        if (!conn || conn->closing){
+            /* hung up meanwhile. what was meant for it is dropped */
+            if (rec->type == REC_PAYLOAD)
+                payload_release(((rec_payload_t *)rec)->payload);
+            continue;
+        }
+        switch (rec->type){
+        case REC_BYTES:
+            if (outq_write(&conn->outq, ((rec_bytes_t *)rec)->data, ((rec_bytes_t *)rec)->len) < 0)
+                DPRINTF(DEBUG_ERRS,"Failed to add a message onto outbuf of client %d\n",conn->fd);
+            break;
+        case REC_PAYLOAD:
+            if (outq_push_ref(&conn->outq, ((rec_payload_t *)rec)->payload) < 0)
+                DPRINTF(DEBUG_ERRS,"Failed to add a shared message onto outbuf of client %d\n",conn->fd);
+            payload_release(((rec_payload_t *)rec)->payload);
+            break;
+        case REC_NOTIFY:
+            conn->notify = 1;
+            conn->notifyBelow = ((rec_notify_t *)rec)->below;
+            break;
+        default:
+            DPRINTF(DEBUG_ERRS,"worker %d: unexpected record %u\n",w->index,rec->type);
+            continue;
+        }
+        conn_queued(w, conn);
+    }
+}
+
+static void *worker_main(void *arg){
+    worker_t *w = arg;
+    int inboxfd = mailbox_fd(&w->inbox);
+    ev_fired_t *fired;
+
+    connvec_init(&w->dirty);
+    connvec_init(&w->stalled);
+    for (;;){
+        int i, numFired = event_wait(w->loop, &fired, outbox_pending(&w->toCore) ? RETRY_MS : -1);
+
+        if (numFired < 0 && errno != EINTR)
+            DEBUG_PERROR("event_wait");
+        for (i = 0; i < numFired; i++){
+            int fd = fired[i].fd;
+            conn_t *conn;
+
+            if (fd == w->listenfd){
+                worker_accept(w);
+                continue;
+            }
+            if (fd == inboxfd){
+                mail_t *mails[TAKE_BATCH];
+                int j, n;
+
+                mailbox_ack(&w->inbox);
+                while ((n = mailbox_take(&w->inbox, mails, TAKE_BATCH)) > 0){
+                    for (j = 0; j < n; j++){
+                        worker_handle_mail(w, mails[j]);
+                        mail_free(mails[j]);
+                    }
+                }
+                continue;
+            }
+            if (!(conn = conn_get(fd)) || conn->closing)
+                continue;
+            if (fired[i].mask & EV_WRITE)
+                conn_send(w, conn);
+            if ((fired[i].mask & EV_READ) && !conn->closing){
+                if (outbox_pending(&w->toCore))
+                    conn_stall(w, conn);
+                else
+                    conn_read(w, conn);
+            }
+        }
+        worker_flush_dirty(w);
+        /* lines, hangups and drains of this round go to the core in one mail */
+        if (outbox_ship(&w->toCore) == 0 && connvec_size(&w->stalled) > 0)
+            worker_resume_reads(w);
+    }
+    return NULL;
+}
+
+int workers_start(int count, const int *listenfds, const char *backend, int setsize){
+    int i;
+
+    if (count > MAX_WORKERS)
+        count = MAX_WORKERS;
+    if (mailbox_init(&coreInbox) < 0)
+        return -1;
+    connTable = calloc(setsize, sizeof(*connTable));
+    /* mailboxes are cache line aligned */
+    workers = aligned_alloc(CACHE_LINE, count * sizeof(worker_t));
+    if (!connTable || !workers){
+        DPRINTF(DEBUG_ERRS,"workers_start: out of memory\n");
+        return -1;
+    }
+    connTableSize = setsize;
+    memset(workers, 0, count * sizeof(worker_t));
+
+    for (i = 0; i < count; i++){
+        worker_t *w = &workers[i];
+
+        w->index = i;
+        w->listenfd = listenfds[i];
+        w->toCore.dest = &coreInbox;
+        if (mailbox_init(&w->inbox) < 0)
+            break;
+        w->loop = event_loop_create(backend, setsize);
+        if (!w->loop || event_add(w->loop, w->listenfd, EV_READ) < 0
+            || event_add(w->loop, mailbox_fd(&w->inbox), EV_READ) < 0){
+            DPRINTF(DEBUG_ERRS,"workers_start: failed to set up the loop of worker %d\n",i);
+            break;
+        }
+        toWorker[i].dest = &w->inbox;
+        toWorker[i].maxOverflow = CORE_MAX_OVERFLOW;
+        if (pthread_create(&w->thread, NULL, worker_main, w) != 0){
+            DPRINTF(DEBUG_ERRS,"workers_start: could only start %d of %d workers\n",i,count);
+            break;
+        }
+        pthread_detach(w->thread);
+    }
+    if (i == 0)
+        return -1;
+    numWorkers = i;
+    return numWorkers;
+}
+
+void rec_line_parse(rec_line_t *rec, parsed_line_t *parsed){
+    int i;
+
+    parsed->prefix = rec->prefix < 0 ? NULL : rec->text + rec->prefix;
+    parsed->command = rec->command < 0 ? NULL : rec->text + rec->command;
+    parsed->cmd = rec->cmd;
+    for (i = 0; i < rec->n_params; i++)
+        parsed->params[i] = rec->text + rec->params[i];
+    parsed->n_params = rec->n_params;
+}
+
+/*
+  core side
+*/
+int worker_post_bytes(client_t *client, const char *data, unsigned len){
+    rec_bytes_t *rec = (rec_bytes_t *)outbox_record(&toWorker[client->worker], REC_BYTES,
+                                                    sizeof(rec_bytes_t) + len + 2, client->sock, 0);
+
+    if (!rec)
+        return -1;
+    memcpy(rec->data, data, len);
+    rec->data[len] = '\r';
+    rec->data[len+1] = '\n';
+    rec->len = len + 2;
+    coreBytesPosted += len + 2;
+    return 0;
+}
+
+int worker_post_payload(client_t *client, payload_t *payload){
+    rec_payload_t *rec = (rec_payload_t *)outbox_record(&toWorker[client->worker], REC_PAYLOAD,
+                                                        sizeof(rec_payload_t), client->sock, 0);
+
+    if (!rec)
+        return -1;
+    payload_retain(payload);
+    rec->payload = payload;
+    coreBytesPosted += payload->len;
+    return 0;
+}
+
+int worker_post_notify(client_t *client, unsigned below){
+    rec_notify_t *rec = (rec_notify_t *)outbox_record(&toWorker[client->worker], REC_NOTIFY,
+                                                      sizeof(rec_notify_t), client->sock, 0);
+
+    if (!rec)
+        return -1;
+    rec->below = below;
+    return 0;
+}
+
+void worker_post_close(int worker, int fd){
+    if (!outbox_record(&toWorker[worker], REC_CLOSE, sizeof(record_t), fd, 0))
+        DPRINTF(DEBUG_ERRS,"worker_post_close: socket %d stays open\n",fd);
+}
+
+int worker_post_join(channel_t *channel, client_t *client){
+    rec_member_t *rec = (rec_member_t *)outbox_record(&toWorker[client->worker], REC_JOIN,
+                                                      sizeof(rec_member_t), client->sock, 0);
+
+    if (!rec)
+        return -1;
+    rec->chan = channel->id;
+    rec->gen = channel->gen;
+    if (channel->workerMembers[client->worker]++ == 0)
+        channel->workerMask |= 1ULL << client->worker;
+    return 0;
+}
+
+void worker_post_part(channel_t *channel, client_t *client){
+    rec_member_t *rec = (rec_member_t *)outbox_record(&toWorker[client->worker], REC_PART,
+                                                      sizeof(rec_member_t), client->sock, 0);
+
+    if (!rec){
+        /* the worker keeps client in its slice, so it is still counted. once the
+           channel is gone, the generation tells the worker the entry is stale */
+        DPRINTF(DEBUG_ERRS,"worker_post_part: client %d stays in the slice of %s\n",client->sock,channel->name);
+        return;
+    }
+    rec->chan = channel->id;
+    rec->gen = channel->gen;
+    if (--channel->workerMembers[client->worker] == 0)
+        channel->workerMask &= ~(1ULL << client->worker);
+}
+
+void worker_post_channel(channel_t *channel, client_t *except, payload_t *payload){
+    unsigned long long mask = channel->workerMask;
+
+    while (mask){
+        int worker = __builtin_ctzll(mask);
+        rec_channel_t *rec;
+
+        mask &= mask - 1;
+        rec = (rec_channel_t *)outbox_record(&toWorker[worker], REC_CHANNEL, sizeof(rec_channel_t),
+                                             except && except->worker == worker ? except->sock : -1, 0);
+        if (!rec)
+            continue;
+        payload_retain(payload);
+        rec->chan = channel->id;
+        rec->gen = channel->gen;
+        rec->payload = payload;
+    }
+}
+
+int workers_ship(void){
+    int i, waiting = 0;
+
+    for (i = 0; i < numWorkers; i++){
+        if (outbox_ship(&toWorker[i]) < 0)
+            waiting++;
+    }
+    return waiting;
+}
+
+int workers_backlogged(void){
+    int i;
+
+    for (i = 0; i < numWorkers; i++){
+        if (outbox_full(&toWorker[i]))
+            return TRUE;
+    }
+    return FALSE;
+}
@@ -0,0 +1,115 @@
+#ifndef _WORKER_H_
+#define _WORKER_H_
+
+#include "common.h"
+#include "outq.h"
+#include "mailbox.h"
+#include "irc_proto.h"
+
+/** WORKER_H
+ *
+ *  I/O workers: the threads that own the client connections.
+ *
+ *  Each worker has its own listening socket (SO_REUSEPORT, so the kernel
+ *  spreads new connections over them), its own event loop, and accepts,
+ *  reads, frames, parses and writes for its connections only. Everything
+ *  IRC (clients, nicks, channels) stays with the core, the main thread,
+ *  which is the only one to touch it.
+ *
+ *  The two sides talk in records (mailbox.h). A worker sends the core
+ *  REC_CONNECT, one REC_LINE per parsed line and REC_CLOSED on hangup; the
+ *  core sends back the bytes and shared payloads to queue, REC_NOTIFY when a
+ *  long reply waits for room (replygen.h) and REC_CLOSE when a client is gone.
+ *
+ *  Only the last step of channel delivery, the fan-out, is split among the
+ *  workers. Channels are not sharded: the channels, their member lists and
+ *  every channel command stay with the core, which remains the one place
+ *  channel work is serialized. Every worker keeps, for each channel, a
+ *  slice mirroring the members connected to it. The core changes it with
+ *  REC_JOIN and REC_PART. A channel line is one REC_CHANNEL to each worker
+ *  with members, which queues it for its slice. A busy channel thus costs
+ *  the core one record per worker instead of one per member. Since
+ *  everything for a worker goes through one mailbox, a client gets channel
+ *  lines and its other lines in the order the core sent them.
+ *
+ *  Memory stays bounded both ways. A worker whose mails to the core are held
+ *  back stops reading its sockets. Once the core holds back a limited number
+ *  of mails for a worker, it stops taking the workers' mails until that
+ *  worker catches up, so the workers stop reading in turn; nothing already
+ *  sent is dropped. A client that does not read is closed once MAX_SENDQ
+ *  bytes wait for it on its worker.
+ *
+ *  A descriptor is closed by its worker only on REC_CLOSE, so it cannot be
+ *  reused while the core still knows the client on it. Records of the
+ *  workers carry the connection serial: lines and hangups still in flight
+ *  when the core dropped a client are recognized and ignored.
+ **/
+
+enum {
+    /* worker -> core */
+    REC_CONNECT = 1,
+    REC_LINE,
+    REC_CLOSED,     /* peer hung up or the connection failed */
+    REC_DRAINED,    /* out queue went below the mark of REC_NOTIFY */
+    /* core -> worker */
+    REC_BYTES,
+    REC_PAYLOAD,
+    REC_NOTIFY,
+    REC_CLOSE,
+    REC_JOIN,       /* the connection joins the worker's slice of a channel */
+    REC_PART,
+    REC_CHANNEL     /* a payload for the worker's slice of a channel */
+};
+
+typedef struct {
+    record_t hdr;
+    int worker;
+    struct sockaddr_storage addr;
+} rec_connect_t;
+
+/* a line parsed by the worker. offsets are into text, -1 for none */
+typedef struct {
+    record_t hdr;
+    const struct cmd_hash_entry *cmd;
+    short prefix, command;
+    short params[MAX_MSG_TOKENS];
+    int n_params;
+    char text[]; /* the line, split in place */
+} rec_line_t;
+
+/* mailbox of the core. workers post to it, the core loop watches mailbox_fd() */
+extern mailbox_t coreInbox;
+
+/* bytes the core posted to any worker so far. replygen.h meters replies with it */
+extern unsigned long long coreBytesPosted;
+
+/* workers_start: starts numWorkers workers, worker i accepting on listenfds[i].
+ *                returns number started, -1 if none could be */
+int workers_start(int numWorkers, const int *listenfds, const char *backend, int setsize);
+
+/* rec_line_parse: parsed line of rec, pointing into rec */
+void rec_line_parse(rec_line_t *rec, parsed_line_t *parsed);
+
+/* worker_post_bytes: len bytes + "\r\n" for client. -1 if out of memory */
+int worker_post_bytes(client_t *client, const char *data, unsigned len);
+/* worker_post_payload: a reference to payload for client. -1 if out of memory */
+int worker_post_payload(client_t *client, payload_t *payload);
+/* worker_post_notify: ask for REC_DRAINED once client's out queue holds less than below bytes */
+int worker_post_notify(client_t *client, unsigned below);
+/* worker_post_close: have worker close its connection fd */
+void worker_post_close(int worker, int fd);
+/* worker_post_join: client joined channel. -1 if out of memory */
+int worker_post_join(channel_t *channel, client_t *client);
+/* worker_post_part: client left channel */
+void worker_post_part(channel_t *channel, client_t *client);
+/* worker_post_channel: payload for every member of channel, but except (NULL for none) */
+void worker_post_channel(channel_t *channel, client_t *except, payload_t *payload);
+
+/* workers_ship: posts what the core queued for the workers during this round.
+ *               returns how many workers' mailboxes were full: ship again soon */
+int workers_ship(void);
+/* workers_backlogged: a worker is too far behind. The core takes no new mails
+ *                     from the workers until it is not */
+int workers_backlogged(void);
+
+#endif /* _WORKER_H_ */